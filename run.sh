@@ -1,4 +1,8 @@
 for file in ./traces/*.bz2; do
     echo "Processing: $file"
-    bunzip2 -kc "$file" | ./src/predictor --tage
+    if [ -f "${file%.bz2}.bpt" ]; then
+        ./src/predictor --tage "${file%.bz2}.bpt"
+    else
+        ./src/predictor --tage "$file"
+    fi
 done
@@ -0,0 +1,54 @@
+//========================================================//
+//  convert.c                                             //
+//  One-time converter from text traces to binary traces  //
+//                                                        //
+//  convert_trace trace.bz2 trace.bpt                     //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+void
+usage()
+{
+  fprintf(stderr,"Usage: convert_trace [<text trace>] <binary trace>\n");
+  fprintf(stderr,"       convert_trace trace.bz2 trace.bpt\n");
+  fprintf(stderr,"       bunzip2 -kc trace.bz2 | convert_trace trace.bpt\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3 || !strcmp(argv[1], "--help")) {
+    usage();
+    exit(argc == 2 ? 0 : 1);
+  }
+
+  FILE *in = stdin;
+  if (argc == 3 && (in = trace_fopen(argv[1])) == NULL) {
+    exit(1);
+  }
+  const char *out_path = argv[argc - 1];
+
+  trace_t trace;
+  trace_load_text(&trace, in);
+  if (in != stdin) {
+    fclose(in);
+  }
+
+  FILE *out = fopen(out_path, "wb");
+  if (out == NULL) {
+    perror(out_path);
+    exit(1);
+  }
+  if (!trace_write(&trace, out) || fclose(out) != 0) {
+    fprintf(stderr, "%s: write failed\n", out_path);
+    exit(1);
+  }
+
+  printf("Branches:        %10llu\n", (unsigned long long)trace.num_branches);
+  trace_close(&trace);
+  return 0;
+}
@@ -0,0 +1,205 @@
+//========================================================//
+//  counters.h                                            //
+//  Packed storage helpers for predictor tables           //
+//                                                        //
+//  2-bit saturating counters are stored four per byte    //
+//  and history tables are packed at their exact width;   //
+//  all tables of an instance share one arena             //
+//========================================================//
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "predictor.h"
+
+//------------------------------------//
+//      Table Arenas                  //
+//------------------------------------//
+
+#define TABLE_ALIGN 64                // Each table starts on a cache line
+#define HUGE_PAGE_SIZE (2u << 20)     // Arenas this large use huge pages
+
+// All tables of one predictor instance, carved out of a single block.
+// Arenas of a huge page or more are mapped at huge page alignment and
+// advised to use transparent huge pages, so a large table costs a few
+// TLB entries instead of one per 4K page.
+typedef struct {
+  uint8_t *base;
+  size_t size;       // Bytes allocated or mapped
+  size_t used;
+  void *block;       // malloc() block behind a small arena
+} table_arena_t;
+
+// Arena bytes a table of 'bytes' takes
+//
+static inline size_t
+table_bytes(size_t bytes)
+{
+  return (bytes + TABLE_ALIGN - 1) & ~(size_t)(TABLE_ALIGN - 1);
+}
+
+// Reserve 'bytes' (the sum of table_bytes() of every table)
+//
+// Returns True if Successful
+//
+static inline int
+table_arena_init(table_arena_t *a, size_t bytes)
+{
+  memset(a, 0, sizeof(*a));
+  if (bytes >= HUGE_PAGE_SIZE) {
+    // Over-map by a huge page and trim to an aligned run
+    size_t size = (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    uint8_t *map = (uint8_t *)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map != MAP_FAILED) {
+      uint8_t *base = (uint8_t *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) &
+                                  ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+      if (base > map) {
+        munmap(map, base - map);
+      }
+      munmap(base + size, map + HUGE_PAGE_SIZE - base);
+      madvise(base, size, MADV_HUGEPAGE);
+      a->base = base;
+      a->size = size;
+      return 1;
+    }
+  }
+  a->block = malloc(bytes + TABLE_ALIGN);
+  if (a->block == NULL) {
+    return 0;
+  }
+  a->base = (uint8_t *)(((uintptr_t)a->block + TABLE_ALIGN - 1) & ~(uintptr_t)(TABLE_ALIGN - 1));
+  a->size = bytes + TABLE_ALIGN;
+  return 1;
+}
+
+// Next table of 'bytes' from the arena (uninitialized)
+//
+static inline void *
+table_arena_take(table_arena_t *a, size_t bytes)
+{
+  void *table = a->base + a->used;
+  a->used += table_bytes(bytes);
+  return table;
+}
+
+// Free every table of the arena
+//
+static inline void
+table_arena_release(table_arena_t *a)
+{
+  if (a->block != NULL) {
+    free(a->block);
+  } else if (a->base != NULL) {
+    munmap(a->base, a->size);
+  }
+  memset(a, 0, sizeof(*a));
+}
+
+//------------------------------------//
+//      Packed 2-bit Counter Tables   //
+//------------------------------------//
+
+// Bytes needed for 'n' 2-bit counters
+//
+static inline size_t
+ctr2_bytes(uint64_t n)
+{
+  return (size_t)((n + 3) >> 2);
+}
+
+// Allocate an uninitialized table of 'n' counters
+//
+static inline uint8_t *
+ctr2_alloc(uint64_t n)
+{
+  return (uint8_t *)malloc(ctr2_bytes(n));
+}
+
+// Set all 'n' counters of 'table' to 'value'
+//
+static inline void
+ctr2_fill(uint8_t *table, uint64_t n, uint8_t value)
+{
+  memset(table, value * 0x55, ctr2_bytes(n));
+}
+
+// Counter 'i' of 'table' (SN, WN, WT or ST)
+//
+static inline uint8_t
+ctr2_get(const uint8_t *table, uint32_t i)
+{
+  return (table[i >> 2] >> ((i & 3) << 1)) & 3;
+}
+
+// Prediction of counter 'i': TAKEN for WT/ST
+//
+static inline uint8_t
+ctr2_predict(const uint8_t *table, uint32_t i)
+{
+  return (table[i >> 2] >> (((i & 3) << 1) + 1)) & 1;
+}
+
+// Saturating step of a single counter value towards 'outcome'
+//
+static inline uint8_t
+ctr2_next(uint8_t counter, uint8_t outcome)
+{
+  return outcome ? counter + (counter != ST) : counter - (counter != SN);
+}
+
+// Move counter 'i' one step towards 'outcome' with one read and one
+// write of its byte
+//
+static inline void
+ctr2_update(uint8_t *table, uint32_t i, uint8_t outcome)
+{
+  int shift = (i & 3) << 1;
+  uint8_t byte = table[i >> 2];
+  uint8_t counter = (byte >> shift) & 3;
+  counter = ctr2_next(counter, outcome);
+  table[i >> 2] = (byte & ~(3 << shift)) | (counter << shift);
+}
+
+//------------------------------------//
+//      Packed History Tables         //
+//------------------------------------//
+
+// Bytes needed for 'n' fields of 'bits' bits (1..32), padded so every
+// field can be read with a single unaligned 64-bit load
+//
+static inline size_t
+bitfield_bytes(uint64_t n, int bits)
+{
+  return (size_t)((n * bits + 7) >> 3) + sizeof(uint64_t);
+}
+
+// Field 'i' of width 'bits'
+//
+static inline uint32_t
+bitfield_get(const uint8_t *table, uint32_t i, int bits)
+{
+  uint64_t pos = (uint64_t)i * bits;
+  uint64_t word;
+  memcpy(&word, table + (pos >> 3), sizeof(word));
+  return (word >> (pos & 7)) & ((1ULL << bits) - 1);
+}
+
+// Set field 'i' of width 'bits' to 'value' (already within 'bits')
+//
+static inline void
+bitfield_set(uint8_t *table, uint32_t i, int bits, uint32_t value)
+{
+  uint64_t pos = (uint64_t)i * bits;
+  uint64_t mask = ((1ULL << bits) - 1) << (pos & 7);
+  uint64_t word;
+  memcpy(&word, table + (pos >> 3), sizeof(word));
+  word = (word & ~mask) | ((uint64_t)value << (pos & 7));
+  memcpy(table + (pos >> 3), &word, sizeof(word));
+}
+
+#endif
@@ -8,11 +8,138 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include "predictor.h"
+#include "trace.h"
+#include "stream.h"
+#include "profile.h"
+#include "sim.h"
+#include "server.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+// Text traces (plain or bzip2) are parsed by a reader thread and
+// consumed here a block at a time
+trace_stream_t *stream = NULL;
+const trace_block_t *block = NULL;
+uint32_t block_pos = 0;
+
+// With --cache, decoded copies of text traces are cached on disk (see
+// trace.h) in 'cache_path', or the default location when NULL
+int use_cache = 0;
+const char *cache_path = NULL;
+
+// Binary trace being replayed, if one was given on the command line
+trace_t trace;
+uint64_t trace_pos = 0;
+
+// Sweep mode: every configuration named on the command line is
+// simulated from a single pass over the trace
+#define SWEEP_BLOCK 4096
+#define SWEEP_FAMILIES 2     // Types run as lockstep families (see run_sweep)
+int sweep = 0;
+predictor_config_t *configs = NULL;
+int num_configs = 0;
+
+// Report simulation throughput after the run
+int timing = 0;
+struct timespec start_time;
+
+// Daemon mode: serve jobs on the Unix domain socket at 'serve_path'
+// (see server.h), with the traces given on the command line resident
+const char *serve_path = NULL;
+
+// Prefetch distance in branches for the predictors that support it,
+// 0 for none (see predictor_set_lookahead)
+#define LOOKAHEAD_DEFAULT 32
+int lookahead = 0;
+
+// Storage budget in bits (0 for none): configurations whose modeled
+// storage exceeds it are rejected before anything is simulated
+uint64_t storage_budget = 0;
+int storage_report = 0;
+
+// Parallel mode: every (trace, configuration) pair is a job on a
+// work-stealing thread pool
+int parallel = 0;
+int num_threads = 0;
+char **trace_paths = NULL;
+int num_traces = 0;
+
+// Sharded mode: one trace split into 'num_shards' contiguous shards
+// simulated in parallel, each warmed up on the 'shard_warmup'
+// branches before it
+int num_shards = 0;
+uint64_t shard_warmup = 65536;
+int shard_verify = 0;
+
+// Benchmark mode: the last configuration timed over every trace
+// given, best of 'bench_reps' runs
+int bench_reps = 0;
+
+// Tuning: successive halving over every configuration given, scored
+// on trace prefixes that double each round until 'tune_finalists'
+// remain, which are then simulated on the full traces
+int tune = 0;
+int tune_finalists = 4;
+uint64_t tune_prefix = 16384;
+
+// Searched by --tune when no --<type> is given
+static const char *tune_space[] = {
+  "gshare:4..20",
+  "tournament:4..13:4..13:4..13",
+  "perceptron:8..48/4:32..512/32",
+  "tage:4..8:8..11:8..11:4:50..250/50:10..12",
+};
+
+// Per-PC profile of the run, NULL unless --profile was given
+#define PROFILE_BLOCK 4096
+profile_t *profile = NULL;
+int profile_top = 20;
+
+// Interval statistics: one CSV row per 'interval_len' branches,
+// written as the run goes
+uint64_t interval_len = 0;
+FILE *interval_out = NULL;
+uint64_t interval_left = 0;
+uint64_t interval_num = 0;
+uint64_t interval_first = 0;
+uint64_t interval_branches = 0;
+uint64_t interval_incorrect = 0;
+int interval_components = 0;
+uint64_t interval_hits[PREDICTOR_MAX_COMPONENTS];
+
+// Sampled simulation: each period of 'sample_period' branches is
+// fast-forwarded (skipped, or trained on with 'sample_train_ff'), then
+// 'sample_warmup' branches train the predictor and the final
+// 'sample_measure' branches are measured
+#define SAMPLE_FF       0
+#define SAMPLE_WARMUP   1
+#define SAMPLE_MEASURE  2
+uint64_t sample_period = 0;
+uint64_t sample_warmup = 0;
+uint64_t sample_measure = 0;
+int sample_train_ff = 0;
+int sample_phase = SAMPLE_FF;
+uint64_t sample_left = 0;
+uint64_t sample_incorrect = 0;      // Mispredictions in the current sample
+uint64_t num_samples = 0;
+uint64_t sampled_incorrect = 0;     // Over all complete samples
+double sample_rate_sum = 0;
+double sample_rate_sumsq = 0;
+
+// Checkpoints: a run can resume from a saved predictor, skipping the
+// trace branches it had already consumed, and can save one once
+// 'checkpoint_at' trace branches have been consumed
+const char *restore_path = NULL;
+const char *checkpoint_path = NULL;
+uint64_t checkpoint_at = 0;
+int checkpoint_saved = 0;
+uint64_t skip_to = 0;
+uint64_t trace_consumed = 0;
 
 // Print out the Usage information to stderr
 //
@@ -20,16 +147,163 @@ void
 usage()
 {
   fprintf(stderr,"Usage: predictor <options> [<trace>]\n");
-  fprintf(stderr,"       bunzip -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr,"       predictor <options> trace.bz2  (decompressed in-process)\n");
+  fprintf(stderr,"       bunzip2 -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr,"       predictor <options> trace.bpt  (binary trace, see convert_trace)\n");
   fprintf(stderr," Options:\n");
   fprintf(stderr," --help       Print this message\n");
   fprintf(stderr," --verbose    Print predictions on stdout\n");
+  fprintf(stderr," --time       Print simulation time and branches/sec\n");
+  fprintf(stderr," --sweep      Simulate every --<type> given (numeric fields may\n"
+                 "              be ranges, e.g. --gshare:8..20) in one trace pass\n");
+  fprintf(stderr," --parallel[:<# threads>]\n"
+                 "              Simulate every --<type> on every trace given, one\n"
+                 "              job per pair, on all cores by default\n");
+  fprintf(stderr," --shards:<# shards>[:<# warmup>[:<verify>]]\n"
+                 "              Split the trace into shards simulated in parallel,\n"
+                 "              each warmed up on the branches before it (65536);\n"
+                 "              with <verify> 1 a serial run measures the error\n");
+  fprintf(stderr," --profile[:<# branches>]\n"
+                 "              Count executions and mispredictions per PC and\n"
+                 "              report the most mispredicted branches (20)\n");
+  fprintf(stderr," --interval:<# branches>[:<csv file>]\n"
+                 "              Write branches, mispredictions and the provider\n"
+                 "              mix of every interval as CSV (stdout by default)\n");
+  fprintf(stderr," --sample:<period>:<warmup>:<measure>[:<train>]\n"
+                 "              Measure only the last <measure> branches of every\n"
+                 "              <period>, after <warmup> training branches; the\n"
+                 "              rest is skipped (or trained on if <train> is 1)\n");
+  fprintf(stderr," --checkpoint:<# branches>:<file>\n"
+                 "              Save the predictor state after that many branches\n");
+  fprintf(stderr," --restore:<file>\n"
+                 "              Resume from a checkpoint: its predictor and state,\n"
+                 "              continuing after the branches it had consumed\n");
+  fprintf(stderr," --budget:<bits>[k][+<bits>]\n"
+                 "              Reject configurations whose modeled storage exceeds\n"
+                 "              the budget (k: Kbits, e.g. 64k+256); sweeps and\n"
+                 "              parallel runs skip them instead\n");
+  fprintf(stderr," --cache[:<dir>]\n"
+                 "              Cache decoded text traces in <dir> (default\n"
+                 "              $BPTRACE_CACHE or ~/.cache/bptrace)\n");
+  fprintf(stderr," --no-cache   Always decode text traces (the default)\n");
+  fprintf(stderr," --lookahead[:<# branches>]\n"
+                 "              Prefetch the table entries of the branch that many\n"
+                 "              ahead (%d) for gshare, bimodal and tage; results\n"
+                 "              are unchanged\n", LOOKAHEAD_DEFAULT);
+  fprintf(stderr," --storage    Print the modeled storage and host memory of every\n"
+                 "              --<type> given and exit\n");
+  fprintf(stderr," --bench[:<# runs>]\n"
+                 "              Time the predictor over the traces given (loaded\n"
+                 "              first), best of 3 runs, and print one tab separated\n"
+                 "              row: branches/sec, ns and cycles per branch, peak RSS\n");
+  fprintf(stderr," --tune[:<# finalists>[:<# prefix>]]\n"
+                 "              Find the best --<type> configurations (a built-in\n"
+                 "              space if none) on the traces given by successive\n"
+                 "              halving on trace prefixes (16384 branches, doubled\n"
+                 "              each round), then run the finalists (4) in full\n");
+  fprintf(stderr," --serve:<socket>[:<# threads>]\n"
+                 "              Run as a daemon taking jobs on a Unix domain socket\n"
+                 "              (see server.h), with the traces given kept in memory,\n"
+                 "              on all cores by default, until interrupted\n");
   fprintf(stderr," --<type>     Branch prediction scheme:\n");
-  fprintf(stderr,"    static\n"
-                "    gshare:<# ghistory>\n"
-                "    tournament:<# ghistory>:<# lhistory>:<# index>\n"
-                "    custom\n"
-                "    tage\n");  
+  for (int i = 0; i < num_predictors; i++) {
+    fprintf(stderr,"    %s\n", predictor_registry[i]->usage);
+  }
+}
+
+// Parse "<n>", "<lo>..<hi>" or "<lo>..<hi>/<step>" at 's'
+//
+// Returns a pointer past the field, or NULL if malformed
+//
+const char *
+parse_range(const char *s, int *lo, int *hi, int *step)
+{
+  char *end;
+  *lo = *hi = strtol(s, &end, 10);
+  *step = 1;
+  if (end == s) {
+    return NULL;
+  }
+  if (!strncmp(end, "..", 2)) {
+    s = end + 2;
+    *hi = strtol(s, &end, 10);
+    if (end == s || *hi < *lo) {
+      return NULL;
+    }
+    if (*end == '/') {
+      s = end + 1;
+      *step = strtol(s, &end, 10);
+      if (end == s || *step < 1) {
+        return NULL;
+      }
+    }
+  }
+  return end;
+}
+
+// Append the cross product of the ':' separated ranges in 'spec'
+// (NULL when no parameters were given) as configurations of the
+// registered predictor 'type'; omitted parameters take its defaults.
+// A configuration outside the predictor's limits fails the option
+//
+// Returns True if Successful
+//
+int
+add_configs(int type, const char *spec)
+{
+  const predictor_ops_t *ops = predictor_registry[type];
+  int lo[PREDICTOR_MAX_PARAMS], hi[PREDICTOR_MAX_PARAMS], step[PREDICTOR_MAX_PARAMS];
+  int given = 0;
+
+  memcpy(lo, ops->defaults, sizeof(lo));
+  memcpy(hi, ops->defaults, sizeof(hi));
+  for (int i = 0; i < PREDICTOR_MAX_PARAMS; i++) {
+    step[i] = 1;
+  }
+  while (spec != NULL) {
+    if (given == ops->num_params) {
+      return 0;
+    }
+    if ((spec = parse_range(spec, &lo[given], &hi[given], &step[given])) == NULL) {
+      return 0;
+    }
+    given++;
+    if (*spec == '\0') {
+      break;
+    }
+    if (*spec++ != ':') {
+      return 0;
+    }
+  }
+  if (given < ops->required_params) {
+    return 0;
+  }
+
+  // Step through the grid with the last parameter varying fastest
+  int cur[PREDICTOR_MAX_PARAMS];
+  memcpy(cur, lo, sizeof(cur));
+  for (;;) {
+    predictor_config_t cfg;
+    cfg.bpType = type;
+    memcpy(cfg.params, cur, sizeof(cur));
+    if (!predictor_valid(&cfg)) {
+      return 0;
+    }
+    configs = (predictor_config_t *)realloc(configs,
+                  sizeof(predictor_config_t) * (num_configs + 1));
+    configs[num_configs++] = cfg;
+
+    int d = ops->num_params - 1;
+    while (d >= 0 && cur[d] + step[d] > hi[d]) {
+      cur[d] = lo[d];
+      d--;
+    }
+    if (d < 0) {
+      break;
+    }
+    cur[d] += step[d];
+  }
+  return 1;
 }
 
 // Process an option and update the predictor
@@ -40,28 +314,144 @@ usage()
 int
 handle_option(char *arg)
 {
-  if (!strcmp(arg,"--static")) {
-    bpType = STATIC;
-  } else if (!strncmp(arg,"--gshare:",9)) {
-    bpType = GSHARE;
-    sscanf(arg+9,"%d", &ghistoryBits);
-  } else if (!strncmp(arg,"--tournament:",13)) {
-    bpType = TOURNAMENT;
-    sscanf(arg+13,"%d:%d:%d", &ghistoryBits, &lhistoryBits, &pcIndexBits);
-  } else if (!strcmp(arg,"--custom")) {
-    bpType = CUSTOM;
-  } else if (!strcmp(arg,"--tage")) {
-  bpType = TAGE;
+  if (!strcmp(arg,"--sweep")) {
+    sweep = 1;
+  } else if (!strcmp(arg,"--parallel")) {
+    parallel = 1;
+  } else if (!strncmp(arg,"--parallel:",11)) {
+    parallel = 1;
+    sscanf(arg+11,"%d", &num_threads);
+  } else if (!strcmp(arg,"--profile") || !strncmp(arg,"--profile:",10)) {
+    // Giving the option again keeps the one profile
+    if (profile == NULL) {
+      profile = profile_create();
+    }
+    if (arg[9] == ':' && (sscanf(arg+10,"%d", &profile_top) != 1 || profile_top < 1)) {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--interval:",11)) {
+    char *end;
+    interval_len = strtoull(arg+11, &end, 10);
+    if (end == arg+11 || interval_len == 0) {
+      return 0;
+    }
+    if (*end == ':') {
+      if ((interval_out = fopen(end + 1, "w")) == NULL) {
+        perror(end + 1);
+        exit(1);
+      }
+    } else if (*end != '\0') {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--sample:",9)) {
+    unsigned long long period, warmup, measure;
+    int n = sscanf(arg+9, "%llu:%llu:%llu:%d", &period, &warmup, &measure, &sample_train_ff);
+    if (n < 3 || measure == 0 || warmup + measure > period) {
+      return 0;
+    }
+    sample_period = period;
+    sample_warmup = warmup;
+    sample_measure = measure;
+  } else if (!strncmp(arg,"--checkpoint:",13)) {
+    char *end;
+    checkpoint_at = strtoull(arg+13, &end, 10);
+    if (end == arg+13 || *end != ':' || end[1] == '\0') {
+      return 0;
+    }
+    checkpoint_path = end + 1;
+  } else if (!strncmp(arg,"--restore:",10)) {
+    restore_path = arg + 10;
+  } else if (!strncmp(arg,"--shards:",9)) {
+    unsigned long long warmup = shard_warmup;
+    if (sscanf(arg+9, "%d:%llu:%d", &num_shards, &warmup, &shard_verify) < 1 ||
+        num_shards < 1) {
+      return 0;
+    }
+    shard_warmup = warmup;
+    shard_verify = shard_verify != 0;
+  } else if (!strncmp(arg,"--budget:",9)) {
+    // "<n>[k][+<n>]", so the custom budget reads as it is stated: 64k+256
+    char *end;
+    storage_budget = strtoull(arg+9, &end, 10);
+    if (end == arg+9) {
+      return 0;
+    }
+    if (*end == 'k' || *end == 'K') {
+      storage_budget *= 1024;
+      end++;
+    }
+    if (*end == '+') {
+      const char *s = end + 1;
+      storage_budget += strtoull(s, &end, 10);
+      if (end == s) {
+        return 0;
+      }
+    }
+    if (*end != '\0' || storage_budget == 0) {
+      return 0;
+    }
+  } else if (!strcmp(arg,"--bench")) {
+    bench_reps = 3;
+  } else if (!strncmp(arg,"--bench:",8)) {
+    if (sscanf(arg+8, "%d", &bench_reps) != 1 || bench_reps < 1) {
+      return 0;
+    }
+  } else if (!strcmp(arg,"--tune")) {
+    tune = 1;
+  } else if (!strncmp(arg,"--tune:",7)) {
+    unsigned long long prefix = tune_prefix;
+    tune = 1;
+    if (sscanf(arg+7, "%d:%llu", &tune_finalists, &prefix) < 1 ||
+        tune_finalists < 1 || prefix == 0) {
+      return 0;
+    }
+    tune_prefix = prefix;
+  } else if (!strcmp(arg,"--cache")) {
+    use_cache = 1;
+  } else if (!strncmp(arg,"--cache:",8) && arg[8] != '\0') {
+    use_cache = 1;
+    cache_path = arg + 8;
+  } else if (!strcmp(arg,"--no-cache")) {
+    use_cache = 0;
+  } else if (!strcmp(arg,"--lookahead")) {
+    lookahead = LOOKAHEAD_DEFAULT;
+  } else if (!strncmp(arg,"--lookahead:",12)) {
+    if (sscanf(arg+12, "%d", &lookahead) != 1 || lookahead < 0 ||
+        lookahead > PREDICTOR_MAX_LOOKAHEAD) {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--serve:",8) && arg[8] != '\0') {
+    // The socket path may hold ':', so only a trailing ":<digits>" is
+    // taken as the thread count
+    char *path = strdup(arg + 8);
+    char *colon = strrchr(path, ':');
+    if (colon != NULL && colon[1] != '\0' && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+      num_threads = atoi(colon + 1);
+      *colon = '\0';
+    }
+    serve_path = path;
+  } else if (!strcmp(arg,"--storage")) {
+    storage_report = 1;
   } else if (!strcmp(arg,"--verbose")) {
     verbose = 1;
+  } else if (!strcmp(arg,"--time")) {
+    timing = 1;
   } else {
-    return 0;
+    // --<name>[:<params>] selects a registered predictor
+    const char *name = arg + 2;
+    size_t n = strcspn(name, ":");
+    int type = predictor_lookup(name, n);
+    if (type < 0) {
+      return 0;
+    }
+    return add_configs(type, name[n] == ':' ? name + n + 1 : NULL);
   }
 
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
+// Reads the next branch from the binary trace or the
+// current block of the input stream and extracts the
 // PC and Outcome of a branch
 //
 // Returns True if Successful 
@@ -69,14 +459,795 @@ handle_option(char *arg)
 int
 read_branch(uint32_t *pc, uint8_t *outcome)
 {
-  if (getline(&buf, &len, stream) == -1) {
+  if (trace.base != NULL) {
+    if (trace_pos == trace.num_branches) {
+      return 0;
+    }
+    *pc = trace.pc[trace_pos];
+    *outcome = trace_outcome(&trace, trace_pos);
+    trace_pos++;
+    return 1;
+  }
+
+  while (block == NULL || block_pos == block->num_branches) {
+    if (block != NULL) {
+      trace_stream_release(stream);
+    }
+    block = trace_stream_next(stream);
+    block_pos = 0;
+    if (block == NULL) {
+      return 0;
+    }
+  }
+
+  *pc = block->pc[block_pos];
+  *outcome = (block->outcome[block_pos >> 3] >> (block_pos & 7)) & 1;
+  block_pos++;
+
+  return 1;
+}
+
+// Write the CSV header and take the provider counts interval rows
+// are measured from
+//
+void
+interval_start(predictor_t *predictor)
+{
+  if (interval_out == NULL) {
+    interval_out = stdout;
+  }
+  interval_left = interval_len;
+  interval_components = predictor_components(predictor, interval_hits);
+
+  fprintf(interval_out, "interval,first_branch,branches,incorrect,rate,per_kbranch");
+  for (int c = 0; c < interval_components; c++) {
+    fprintf(interval_out, ",provider_%d", c);
+  }
+  fprintf(interval_out, "\n");
+}
+
+// Write the row of the current interval and start the next one
+//
+void
+interval_emit(predictor_t *predictor)
+{
+  if (interval_branches == 0) {
+    return;
+  }
+  fprintf(interval_out, "%llu,%llu,%llu,%llu,%.3f,%.3f",
+          (unsigned long long)interval_num, (unsigned long long)interval_first,
+          (unsigned long long)interval_branches, (unsigned long long)interval_incorrect,
+          100.0 * interval_incorrect / interval_branches,
+          1000.0 * interval_incorrect / interval_branches);
+
+  // Share of the interval's predictions made by each component
+  uint64_t hits[PREDICTOR_MAX_COMPONENTS];
+  predictor_components(predictor, hits);
+  for (int c = 0; c < interval_components; c++) {
+    fprintf(interval_out, ",%.4f", (double)(hits[c] - interval_hits[c]) / interval_branches);
+    interval_hits[c] = hits[c];
+  }
+  fprintf(interval_out, "\n");
+
+  interval_num++;
+  interval_first += interval_branches;
+  interval_branches = 0;
+  interval_incorrect = 0;
+  interval_left = interval_len;
+}
+
+// Account 'branches' simulated branches with 'incorrect' mispredictions,
+// which never cross an interval boundary
+//
+static inline void
+interval_count(predictor_t *predictor, uint64_t branches, uint64_t incorrect)
+{
+  interval_branches += branches;
+  interval_incorrect += incorrect;
+  interval_left -= branches;
+  if (interval_left == 0) {
+    interval_emit(predictor);
+  }
+}
+
+// Move to the next phase of the sampling period, recording the sample
+// that just completed
+//
+void
+sample_advance()
+{
+  do {
+    if (sample_phase == SAMPLE_MEASURE) {
+      double rate = (double)sample_incorrect / sample_measure;
+      num_samples++;
+      sampled_incorrect += sample_incorrect;
+      sample_rate_sum += rate;
+      sample_rate_sumsq += rate * rate;
+      sample_incorrect = 0;
+    }
+    sample_phase = (sample_phase + 1) % 3;
+    sample_left = sample_phase == SAMPLE_FF ? sample_period - sample_warmup - sample_measure :
+                  sample_phase == SAMPLE_WARMUP ? sample_warmup : sample_measure;
+  } while (sample_left == 0);
+}
+
+// Sampled simulation of branches [begin, n) of a block
+//
+// Returns the number of mispredictions in measured branches
+//
+uint32_t
+sample_run(predictor_t *predictor, const uint32_t *pc, const uint8_t *outcome,
+           uint64_t begin, uint64_t n)
+{
+  uint32_t mispredictions = 0;
+  while (begin < n) {
+    uint64_t end = n - begin > sample_left ? begin + sample_left : n;
+    if (sample_phase == SAMPLE_MEASURE) {
+      uint32_t incorrect = predictor_run(predictor, pc, outcome, begin, end);
+      sample_incorrect += incorrect;
+      mispredictions += incorrect;
+    } else if (sample_phase == SAMPLE_WARMUP || sample_train_ff) {
+      predictor_run(predictor, pc, outcome, begin, end);
+    }
+    sample_left -= end - begin;
+    if (sample_left == 0) {
+      sample_advance();
+    }
+    begin = end;
+  }
+  return mispredictions;
+}
+
+// Print the misprediction rate estimated from the complete samples and
+// its 95% confidence interval (normal approximation over the per
+// sample rates)
+//
+void
+sample_report(uint64_t num_branches)
+{
+  double rate = (double)sampled_incorrect / (num_samples * sample_measure);
+  double ci = 0;
+  if (num_samples > 1) {
+    double mean = sample_rate_sum / num_samples;
+    double var = (sample_rate_sumsq - num_samples * mean * mean) / (num_samples - 1);
+    ci = 1.96 * sqrt(var > 0 ? var / num_samples : 0);
+  }
+  printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+  printf("Incorrect:       %10.0f  (estimated)\n", rate * num_branches);
+  printf("Misprediction Rate: %7.3f  +- %.3f (95%% CI)\n", 100 * rate, 100 * ci);
+  printf("Samples:         %10llu\n", (unsigned long long)num_samples);
+  printf("Measured:        %10llu\n", (unsigned long long)(num_samples * sample_measure));
+}
+
+// Predict and train 'predictor' on branches [begin, n) of a block, also
+// feeding the mispredictions to the per-PC profile and the interval
+// statistics when they are being collected
+//
+// Returns the number of mispredictions
+//
+uint32_t
+simulate(predictor_t *predictor, const uint32_t *pc, const uint8_t *outcome,
+         uint64_t begin, uint64_t n)
+{
+  if (sample_period > 0) {
+    return sample_run(predictor, pc, outcome, begin, n);
+  }
+  if (profile == NULL && interval_len == 0) {
+    return predictor_run(predictor, pc, outcome, begin, n);
+  }
+
+  uint32_t mispredictions = 0;
+  uint32_t missed[PROFILE_BLOCK];
+  while (begin < n) {
+    // Stop at interval boundaries and keep profiled chunks within the
+    // 'missed' buffer
+    uint64_t end = n;
+    if (interval_len > 0 && end - begin > interval_left) {
+      end = begin + interval_left;
+    }
+    if (profile != NULL && end - begin > PROFILE_BLOCK) {
+      end = begin + PROFILE_BLOCK;
+    }
+
+    uint32_t incorrect;
+    if (profile == NULL) {
+      incorrect = predictor_run(predictor, pc, outcome, begin, end);
+    } else {
+      incorrect = predictor_run_block(predictor, pc, outcome, begin, end, missed);
+      profile_missed(profile, missed, incorrect);
+    }
+    if (interval_len > 0) {
+      interval_count(predictor, end - begin, incorrect);
+    }
+    mispredictions += incorrect;
+    begin = end;
+  }
+  return mispredictions;
+}
+
+// Save the predictor to 'checkpoint_path' if the checkpoint position
+// has just been reached
+//
+void
+checkpoint_maybe(predictor_t *predictor)
+{
+  if (checkpoint_path == NULL || checkpoint_saved || trace_consumed != checkpoint_at) {
+    return;
+  }
+  FILE *f = fopen(checkpoint_path, "wb");
+  if (f == NULL || !predictor_save(predictor, trace_consumed, f) || fclose(f) != 0) {
+    fprintf(stderr, "%s: cannot write checkpoint\n", checkpoint_path);
+    exit(1);
+  }
+  checkpoint_saved = 1;
+}
+
+// Feed the next 'n' branches of the trace to 'predictor', skipping
+// those a restored checkpoint had already consumed and stopping at
+// the checkpoint position on the way
+//
+// Returns the number of mispredictions; 'num_branches' is increased
+// by the number of branches simulated
+//
+uint64_t
+replay(predictor_t *predictor, const uint32_t *pc, const uint8_t *outcome,
+       uint64_t n, uint64_t *num_branches)
+{
+  uint64_t mispredictions = 0;
+  uint64_t begin = 0;
+  if (trace_consumed < skip_to) {
+    begin = skip_to - trace_consumed < n ? skip_to - trace_consumed : n;
+    trace_consumed += begin;
+  }
+  while (begin < n) {
+    checkpoint_maybe(predictor);
+    uint64_t end = n;
+    if (checkpoint_path != NULL && !checkpoint_saved && checkpoint_at > trace_consumed &&
+        checkpoint_at - trace_consumed < end - begin) {
+      end = begin + (checkpoint_at - trace_consumed);
+    }
+    if (end - begin > SIM_RUN_CHUNK) {
+      end = begin + SIM_RUN_CHUNK;
+    }
+    mispredictions += simulate(predictor, pc, outcome, begin, end);
+    *num_branches += end - begin;
+    trace_consumed += end - begin;
+    begin = end;
+  }
+  checkpoint_maybe(predictor);
+  return mispredictions;
+}
+
+// Print the time since start_time and the rate of 'branches' over it
+//
+void
+report_time(double branches)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double secs = (now.tv_sec - start_time.tv_sec) + 1e-9 * (now.tv_nsec - start_time.tv_nsec);
+  printf("Simulation Time:    %8.3f s\n", secs);
+  printf("Branches/sec:       %12.0f\n", branches / secs);
+}
+
+// predictor_create() for configuration 'cfg', exiting with an error
+// if its tables cannot be allocated
+//
+predictor_t *
+create_predictor(const predictor_config_t *cfg)
+{
+  predictor_t *p = predictor_create(cfg);
+  if (p == NULL) {
+    char name[64];
+    predictor_describe(cfg, name, sizeof(name));
+    fprintf(stderr, "%s: cannot allocate the predictor tables\n", name);
+    exit(1);
+  }
+  return p;
+}
+
+// sim_run_jobs(), exiting with an error if a job's predictor cannot
+// be allocated
+//
+void
+run_jobs(sim_job_t *jobs, int num_jobs)
+{
+  if (!sim_run_jobs(jobs, num_jobs, num_threads)) {
+    fprintf(stderr, "cannot allocate the predictor tables\n");
+    exit(1);
+  }
+}
+
+// Width of the Configuration column of the reports: the longest name
+// among 'configs', and at least 24
+//
+int
+name_width()
+{
+  int width = 24;
+  for (int c = 0; c < num_configs; c++) {
+    char name[64];
+    predictor_describe(&configs[c], name, sizeof(name));
+    if ((int)strlen(name) > width) {
+      width = strlen(name);
+    }
+  }
+  return width;
+}
+
+// Print the modeled storage and host memory of every configuration
+//
+void
+print_storage()
+{
+  int width = name_width();
+  printf("%-*s %12s %10s %12s\n", width, "Configuration", "Bits", "Kbits", "Host Bytes");
+  for (int c = 0; c < num_configs; c++) {
+    char name[64];
+    predictor_t *p = create_predictor(&configs[c]);
+    predictor_describe(&configs[c], name, sizeof(name));
+    uint64_t bits = predictor_storage_bits(p);
+    printf("%-*s %12llu %10.2f %12llu\n", width, name, (unsigned long long)bits,
+           bits / 1024.0, (unsigned long long)predictor_host_bytes(p));
+    predictor_destroy(p);
+  }
+}
+
+// Drop the configurations whose modeled storage exceeds the budget,
+// noting each on stderr
+//
+// Returns True if the last configuration (the one a single run
+// simulates) is within the budget
+//
+int
+apply_budget()
+{
+  int last_fits = 1;
+  int kept = 0;
+  for (int c = 0; c < num_configs; c++) {
+    uint64_t bits = predictor_config_bits(&configs[c]);
+    if (bits <= storage_budget) {
+      configs[kept++] = configs[c];
+      continue;
+    }
+    char name[64];
+    predictor_describe(&configs[c], name, sizeof(name));
+    fprintf(stderr, "%s: %llu bits exceeds the budget of %llu\n", name,
+            (unsigned long long)bits, (unsigned long long)storage_budget);
+    last_fits = c < num_configs - 1;
+  }
+  num_configs = kept;
+  return last_fits;
+}
+
+// Simulate every configuration in 'configs' over the trace, feeding
+// each block of branches to all instances before reading the next.
+// Gshare and bimodal configurations of several widths run as one
+// lockstep family per type instead of as separate instances.
+//
+void
+run_sweep()
+{
+  static const int family_types[SWEEP_FAMILIES] = { GSHARE, BIMODAL };
+  predictor_family_t *families[SWEEP_FAMILIES];
+  int *members[SWEEP_FAMILIES];            // Config of each family member
+  int num_members[SWEEP_FAMILIES];
+  uint64_t *family_incorrect[SWEEP_FAMILIES];
+
+  predictor_t **preds = (predictor_t **)calloc(num_configs, sizeof(predictor_t *));
+  uint64_t *incorrect = (uint64_t *)calloc(num_configs, sizeof(uint64_t));
+  predictor_config_t *cfgs = (predictor_config_t *)malloc(sizeof(predictor_config_t) * num_configs);
+  uint32_t pcs[SWEEP_BLOCK];
+  uint8_t outcomes[SWEEP_BLOCK / 8];
+  uint64_t num_branches = 0;
+
+  for (int k = 0; k < SWEEP_FAMILIES; k++) {
+    members[k] = (int *)malloc(sizeof(int) * num_configs);
+    num_members[k] = 0;
+    for (int c = 0; c < num_configs; c++) {
+      if (configs[c].bpType == family_types[k] && predictor_family_member(&configs[c])) {
+        cfgs[num_members[k]] = configs[c];
+        members[k][num_members[k]++] = c;
+      }
+    }
+    families[k] = NULL;
+    family_incorrect[k] = (uint64_t *)calloc(num_members[k] + 1, sizeof(uint64_t));
+    if (num_members[k] > 1) {
+      families[k] = predictor_family_create(cfgs, num_members[k]);
+    }
+    if (families[k] == NULL) {
+      // Simulated one by one instead
+      num_members[k] = 0;
+    }
+  }
+  for (int c = 0; c < num_configs; c++) {
+    preds[c] = create_predictor(&configs[c]);
+    predictor_set_lookahead(preds[c], lookahead);
+  }
+  for (int k = 0; k < SWEEP_FAMILIES; k++) {
+    for (int m = 0; m < num_members[k]; m++) {
+      predictor_destroy(preds[members[k][m]]);
+      preds[members[k][m]] = NULL;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  int n;
+  do {
+    uint8_t outcome;
+    memset(outcomes, 0, sizeof(outcomes));
+    for (n = 0; n < SWEEP_BLOCK && read_branch(&pcs[n], &outcome); n++) {
+      outcomes[n >> 3] |= outcome << (n & 7);
+    }
+    num_branches += n;
+
+    for (int k = 0; k < SWEEP_FAMILIES; k++) {
+      if (families[k] != NULL) {
+        predictor_family_run(families[k], pcs, outcomes, 0, n, family_incorrect[k]);
+      }
+    }
+    for (int c = 0; c < num_configs; c++) {
+      if (preds[c] != NULL) {
+        incorrect[c] += predictor_run(preds[c], pcs, outcomes, 0, n);
+      }
+    }
+  } while (n == SWEEP_BLOCK);
+
+  if (timing) {
+    report_time((double)num_branches * num_configs);
+  }
+
+  for (int k = 0; k < SWEEP_FAMILIES; k++) {
+    for (int m = 0; m < num_members[k]; m++) {
+      incorrect[members[k][m]] = family_incorrect[k][m];
+    }
+    predictor_family_destroy(families[k]);
+    free(members[k]);
+    free(family_incorrect[k]);
+  }
+
+  int width = name_width();
+  printf("%-*s %10s %10s %7s\n", width, "Configuration", "Branches", "Incorrect", "Rate");
+  for (int c = 0; c < num_configs; c++) {
+    char name[64];
+    predictor_describe(&configs[c], name, sizeof(name));
+    float mispredict_rate = 100*((float)incorrect[c] / (float)num_branches);
+    printf("%-*s %10llu %10llu %7.3f\n", width, name, (unsigned long long)num_branches,
+           (unsigned long long)incorrect[c], mispredict_rate);
+    predictor_destroy(preds[c]);
+  }
+
+  free(preds);
+  free(incorrect);
+  free(cfgs);
+}
+
+// Simulate every configuration on every trace on the thread pool and
+// print one aggregated report, followed by the mean rate per config
+//
+int
+run_parallel()
+{
+  trace_t *traces = (trace_t *)calloc(num_traces, sizeof(trace_t));
+  for (int t = 0; t < num_traces; t++) {
+    if (!trace_load(&traces[t], trace_paths[t])) {
+      return 0;
+    }
+  }
+
+  int num_jobs = num_traces * num_configs;
+  sim_job_t *jobs = (sim_job_t *)calloc(num_jobs, sizeof(sim_job_t));
+  for (int t = 0; t < num_traces; t++) {
+    for (int c = 0; c < num_configs; c++) {
+      jobs[t * num_configs + c].trace = &traces[t];
+      jobs[t * num_configs + c].cfg = configs[c];
+      jobs[t * num_configs + c].end = traces[t].num_branches;
+      jobs[t * num_configs + c].lookahead = lookahead;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  run_jobs(jobs, num_jobs);
+  if (timing) {
+    double branches = 0;
+    for (int j = 0; j < num_jobs; j++) {
+      branches += jobs[j].num_branches;
+    }
+    report_time(branches);
+  }
+
+  int width = name_width();
+  printf("%-20s %-*s %10s %10s %7s\n",
+         "Trace", width, "Configuration", "Branches", "Incorrect", "Rate");
+  for (int j = 0; j < num_jobs; j++) {
+    char name[64];
+    const char *trace_name = strrchr(trace_paths[j / num_configs], '/');
+    trace_name = trace_name ? trace_name + 1 : trace_paths[j / num_configs];
+    predictor_describe(&jobs[j].cfg, name, sizeof(name));
+    float mispredict_rate = 100*((float)jobs[j].mispredictions / (float)jobs[j].num_branches);
+    printf("%-20s %-*s %10llu %10llu %7.3f\n", trace_name, width, name,
+           (unsigned long long)jobs[j].num_branches,
+           (unsigned long long)jobs[j].mispredictions, mispredict_rate);
+  }
+  for (int c = 0; c < num_configs; c++) {
+    char name[64];
+    float total = 0;
+    for (int t = 0; t < num_traces; t++) {
+      sim_job_t *job = &jobs[t * num_configs + c];
+      total += 100*((float)job->mispredictions / (float)job->num_branches);
+    }
+    predictor_describe(&configs[c], name, sizeof(name));
+    printf("%-20s %-*s %10s %10s %7.3f\n", "Average", width, name, "", "", total / num_traces);
+  }
+
+  for (int t = 0; t < num_traces; t++) {
+    trace_close(&traces[t]);
+  }
+  free(traces);
+  free(jobs);
+  return 1;
+}
+
+// Simulate the last configuration on the last trace as 'num_shards'
+// shards in parallel and merge their counts. A shard starts from a
+// cold predictor, so the warmup before it only approximates the state
+// a serial run would have. How far from warm a shard still is at its
+// start is shown by comparing the end of its cold warmup with the
+// previous shard's warm run over the same branches; the error itself
+// is only measured, by a serial run alongside, when verifying.
+//
+int
+run_sharded()
+{
+  trace_t t;
+  if (!trace_load(&t, trace_paths[num_traces - 1])) {
     return 0;
   }
 
-  uint32_t tmp;
-  sscanf(buf,"0x%x %d\n",pc,&tmp);
-  *outcome = tmp;
+  // The serial run, if verifying, is one more job after the shards
+  sim_job_t *jobs = (sim_job_t *)calloc(num_shards + 1, sizeof(sim_job_t));
+  jobs[num_shards].trace = &t;
+  jobs[num_shards].cfg = configs[num_configs - 1];
+  jobs[num_shards].end = t.num_branches;
+  jobs[num_shards].lookahead = lookahead;
+  for (int k = 0; k < num_shards; k++) {
+    sim_job_t *job = &jobs[k];
+    job->trace = &t;
+    job->cfg = configs[num_configs - 1];
+    job->begin = t.num_branches * k / num_shards;
+    job->end = t.num_branches * (k + 1) / num_shards;
+    job->warmup = job->begin < shard_warmup ? job->begin : shard_warmup;
+    job->probe = shard_warmup / 2;
+    job->lookahead = lookahead;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  run_jobs(jobs, num_shards + shard_verify);
+  if (timing) {
+    report_time(t.num_branches);
+  }
+
+  uint64_t num_branches = 0;
+  uint64_t mispredictions = 0;
+  int64_t excess = 0;
+  uint64_t probed = 0;
+  for (int k = 0; k < num_shards; k++) {
+    num_branches += jobs[k].num_branches;
+    mispredictions += jobs[k].mispredictions;
+    if (k == 0 || jobs[k].warmup < shard_warmup || jobs[k - 1].num_branches < shard_warmup) {
+      continue;
+    }
+    // Extra mispredictions of the cold start over the last half of its
+    // warmup, against the warm previous shard on the same branches
+    excess += (int64_t)jobs[k].warmup_probe[1] - (int64_t)jobs[k - 1].tail_probe[1];
+    probed += jobs[k].probe;
+  }
+
+  printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+  printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions);
+  float mispredict_rate = 100*((float)mispredictions / (float)num_branches);
+  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  printf("Shards:          %10d\n", num_shards);
+  printf("Warmup Excess:   %10lld  (%.3f rate over %llu probed branches)\n",
+         (long long)excess, probed ? 100.0 * excess / probed : 0,
+         (unsigned long long)probed);
+  if (shard_verify) {
+    int64_t actual = (int64_t)mispredictions - jobs[num_shards].mispredictions;
+    printf("Serial Incorrect:%10llu\n", (unsigned long long)jobs[num_shards].mispredictions);
+    printf("Actual Error:    %10lld  (%.3f rate)\n", (long long)actual,
+           100.0 * actual / num_branches);
+  }
+
+  trace_close(&t);
+  free(jobs);
+  return 1;
+}
+
+// Time-stamp counter, or 0 where there is none
+//
+static inline uint64_t
+read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Time the last configuration over every trace, all loaded before the
+// clock starts, keeping the fastest of 'bench_reps' runs. Each run
+// starts from a fresh instance, created outside the timed region.
+// Cycles are time-stamp counter ticks, which run at a fixed rate
+// rather than the core clock.
+//
+int
+run_bench()
+{
+  trace_t *traces = (trace_t *)calloc(num_traces, sizeof(trace_t));
+  uint64_t branches = 0;
+  for (int t = 0; t < num_traces; t++) {
+    if (!trace_load(&traces[t], trace_paths[t])) {
+      return 0;
+    }
+    branches += traces[t].num_branches;
+  }
+
+  const predictor_config_t *cfg = &configs[num_configs - 1];
+  double best = 0;
+  uint64_t best_cycles = 0;
+  uint64_t mispredictions = 0;
+  for (int r = 0; r < bench_reps; r++) {
+    predictor_t *p = create_predictor(cfg);
+    predictor_set_lookahead(p, lookahead);
+    struct timespec start, end;
+    uint64_t incorrect = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t cycles = read_cycles();
+    for (int t = 0; t < num_traces; t++) {
+      incorrect += sim_run(p, &traces[t], 0, traces[t].num_branches);
+    }
+    cycles = read_cycles() - cycles;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    predictor_destroy(p);
+
+    double secs = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+    if (r == 0 || secs < best) {
+      best = secs;
+      best_cycles = cycles;
+    }
+    mispredictions = incorrect;
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  char name[64];
+  predictor_describe(cfg, name, sizeof(name));
+  printf("config\tbranches\tmispredictions\tseconds\tbranches_per_sec\t"
+         "ns_per_branch\tcycles_per_branch\tpeak_rss_kb\n");
+  printf("%s\t%llu\t%llu\t%.6f\t%.0f\t%.3f\t%.3f\t%ld\n", name,
+         (unsigned long long)branches, (unsigned long long)mispredictions, best,
+         branches / best, 1e9 * best / branches, (double)best_cycles / branches,
+         usage.ru_maxrss);
+
+  for (int t = 0; t < num_traces; t++) {
+    trace_close(&traces[t]);
+  }
+  free(traces);
+  return 1;
+}
+
+// A tuning candidate and its mean misprediction rate over the traces
+typedef struct {
+  predictor_config_t cfg;
+  double rate;
+} tune_entry_t;
+
+static int
+tune_compare(const void *a, const void *b)
+{
+  double x = ((const tune_entry_t *)a)->rate, y = ((const tune_entry_t *)b)->rate;
+  return (x > y) - (x < y);
+}
+
+// Score the first 'n' candidates on the first 'prefix' branches of
+// every trace, all (candidate, trace) pairs on the thread pool, and
+// sort them best first
+//
+// Returns the number of branches simulated
+//
+double
+tune_round(tune_entry_t *cand, int n, trace_t *traces, uint64_t prefix)
+{
+  sim_job_t *jobs = (sim_job_t *)calloc((size_t)n * num_traces, sizeof(sim_job_t));
+  for (int c = 0; c < n; c++) {
+    for (int t = 0; t < num_traces; t++) {
+      sim_job_t *job = &jobs[c * num_traces + t];
+      job->trace = &traces[t];
+      job->cfg = cand[c].cfg;
+      job->end = traces[t].num_branches < prefix ? traces[t].num_branches : prefix;
+      job->lookahead = lookahead;
+    }
+  }
+  run_jobs(jobs, n * num_traces);
+
+  double branches = 0;
+  for (int c = 0; c < n; c++) {
+    cand[c].rate = 0;
+    for (int t = 0; t < num_traces; t++) {
+      sim_job_t *job = &jobs[c * num_traces + t];
+      cand[c].rate += 100.0 * job->mispredictions / job->num_branches / num_traces;
+      branches += job->num_branches;
+    }
+  }
+  qsort(cand, n, sizeof(tune_entry_t), tune_compare);
+  free(jobs);
+  return branches;
+}
 
+// Successive halving over 'configs': every round scores the remaining
+// candidates on trace prefixes, keeps the better half and doubles the
+// prefix, so each round costs about the same. Short prefixes favour
+// predictors that warm up quickly, which is why the finalists are
+// ranked on the full traces.
+//
+int
+run_tune()
+{
+  trace_t *traces = (trace_t *)calloc(num_traces, sizeof(trace_t));
+  uint64_t longest = 0;
+  for (int t = 0; t < num_traces; t++) {
+    if (!trace_load(&traces[t], trace_paths[t])) {
+      return 0;
+    }
+    if (traces[t].num_branches > longest) {
+      longest = traces[t].num_branches;
+    }
+  }
+
+  tune_entry_t *cand = (tune_entry_t *)malloc(sizeof(tune_entry_t) * num_configs);
+  for (int c = 0; c < num_configs; c++) {
+    cand[c].cfg = configs[c];
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  double branches = 0;
+  int n = num_configs;
+  int full = 0;
+  uint64_t prefix = tune_prefix;
+  printf("%-5s %8s %10s %7s  %s\n", "Round", "Configs", "Prefix", "Rate", "Best");
+  for (int round = 0; n > tune_finalists; round++) {
+    full = prefix >= longest;
+    branches += tune_round(cand, n, traces, prefix);
+    char name[64];
+    predictor_describe(&cand[0].cfg, name, sizeof(name));
+    printf("%-5d %8d %10llu %7.3f  %s\n", round, n,
+           (unsigned long long)(full ? longest : prefix), cand[0].rate, name);
+    fflush(stdout);
+    n = full || n / 2 < tune_finalists ? tune_finalists : n / 2;
+    prefix *= 2;
+  }
+  if (!full) {
+    branches += tune_round(cand, n, traces, UINT64_MAX);
+  }
+  if (timing) {
+    report_time(branches);
+  }
+
+  int width = name_width();
+  printf("\n%-5s %-*s %10s %7s\n", "Rank", width, "Configuration", "Bits", "Rate");
+  for (int c = 0; c < n; c++) {
+    char name[64];
+    predictor_describe(&cand[c].cfg, name, sizeof(name));
+    printf("%-5d %-*s %10llu %7.3f\n", c + 1, width, name,
+           (unsigned long long)predictor_config_bits(&cand[c].cfg), cand[c].rate);
+  }
+
+  for (int t = 0; t < num_traces; t++) {
+    trace_close(&traces[t]);
+  }
+  free(traces);
+  free(cand);
   return 1;
 }
 
@@ -84,8 +1255,7 @@ int
 main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
-  bpType = STATIC;
+  FILE *input = stdin;
   verbose = 0;
 
   // Process cmdline Arguments
@@ -99,46 +1269,304 @@ main(int argc, char *argv[])
         usage();
         exit(1);
       }
+    } else {
+      trace_paths = (char **)realloc(trace_paths, sizeof(char *) * (num_traces + 1));
+      trace_paths[num_traces++] = argv[i];
+    }
+  }
+
+  if (use_cache) {
+    use_cache = trace_cache_enable(cache_path);
+  }
+
+  // Resume from a checkpoint, which must match any predictor named on
+  // the command line
+  predictor_t *predictor = NULL;
+  if (restore_path != NULL) {
+    FILE *f = fopen(restore_path, "rb");
+    if (f == NULL || (predictor = predictor_restore(f, &skip_to)) == NULL) {
+      fprintf(stderr, "%s: not a valid checkpoint\n", restore_path);
+      exit(1);
+    }
+    fclose(f);
+    const predictor_config_t *cfg = predictor_config(predictor);
+    if (num_configs > 0 && memcmp(cfg, &configs[num_configs - 1], sizeof(*cfg))) {
+      char name[64];
+      predictor_describe(cfg, name, sizeof(name));
+      fprintf(stderr, "%s: checkpoint is of %s\n", restore_path, name);
+      exit(1);
+    }
+    if (num_configs == 0) {
+      configs = (predictor_config_t *)malloc(sizeof(predictor_config_t));
+      configs[num_configs++] = *cfg;
+    }
+  }
+
+  if (serve_path != NULL) {
+    if (num_configs > 0 || sweep || parallel || tune || bench_reps > 0 || num_shards > 0 ||
+        verbose || profile != NULL || interval_len > 0 || sample_period > 0 ||
+        restore_path != NULL || checkpoint_path != NULL || storage_report) {
+      fprintf(stderr, "--serve only combines with --cache, --no-cache, --lookahead and traces\n");
+      exit(1);
+    }
+    int ok = server_run(serve_path, trace_paths, num_traces, num_threads, lookahead);
+    free(trace_paths);
+    return ok ? 0 : 1;
+  }
+
+  if (tune && num_configs == 0) {
+    for (size_t i = 0; i < sizeof(tune_space) / sizeof(tune_space[0]); i++) {
+      size_t n = strcspn(tune_space[i], ":");
+      add_configs(predictor_lookup(tune_space[i], n), tune_space[i] + n + 1);
+    }
+  }
+  if (num_configs == 0) {
+    add_configs(STATIC, NULL);
+  }
+
+  if (storage_report) {
+    print_storage();
+    free(configs);
+    free(trace_paths);
+    return 0;
+  }
+  if (storage_budget > 0) {
+    // Sweeps, parallel runs and tuning go on with what fits; a single
+    // run only simulates the last configuration, so it must fit
+    int last_fits = apply_budget();
+    if (num_configs == 0 || (!sweep && !parallel && !tune && !last_fits)) {
+      fprintf(stderr, "no configuration within the storage budget\n");
+      exit(1);
+    }
+  }
+
+  if (bench_reps > 0 && (tune || sweep || parallel || num_shards > 0 || verbose ||
+                         profile != NULL || interval_len > 0 || sample_period > 0 ||
+                         restore_path != NULL || checkpoint_path != NULL)) {
+    fprintf(stderr, "--bench only combines with a predictor type\n");
+    exit(1);
+  }
+  if (bench_reps > 0) {
+    if (num_traces == 0) {
+      fprintf(stderr, "--bench needs at least one trace file\n");
+      exit(1);
+    }
+    int ok = run_bench();
+    free(configs);
+    free(trace_paths);
+    return ok ? 0 : 1;
+  }
+  if (tune && (sweep || parallel || num_shards > 0 || verbose || profile != NULL ||
+               interval_len > 0 || sample_period > 0 || restore_path != NULL ||
+               checkpoint_path != NULL)) {
+    fprintf(stderr, "--tune only combines with --budget, --time and predictor types\n");
+    exit(1);
+  }
+  if (tune) {
+    if (num_traces == 0) {
+      fprintf(stderr, "--tune needs at least one trace file\n");
+      exit(1);
+    }
+    int ok = run_tune();
+    free(configs);
+    free(trace_paths);
+    return ok ? 0 : 1;
+  }
+
+  if ((profile != NULL || interval_len > 0) && (sweep || parallel)) {
+    fprintf(stderr, "--profile and --interval apply to a single predictor run\n");
+    exit(1);
+  }
+  if ((restore_path != NULL || checkpoint_path != NULL) && (sweep || parallel)) {
+    fprintf(stderr, "--checkpoint and --restore apply to a single predictor run\n");
+    exit(1);
+  }
+  if (num_shards > 0 && (sweep || parallel || verbose || profile != NULL || interval_len > 0 ||
+                         sample_period > 0 || restore_path != NULL || checkpoint_path != NULL)) {
+    fprintf(stderr, "--shards only combines with --time and a predictor type\n");
+    exit(1);
+  }
+  if (sample_period > 0 && (sweep || parallel || verbose || profile != NULL || interval_len > 0)) {
+    fprintf(stderr, "--sample cannot be combined with --sweep, --parallel, --verbose,\n"
+                    "--profile or --interval\n");
+    exit(1);
+  }
+
+  if (num_shards > 0) {
+    if (num_traces == 0) {
+      fprintf(stderr, "--shards needs a trace file\n");
+      exit(1);
+    }
+    int ok = run_sharded();
+    free(configs);
+    free(trace_paths);
+    return ok ? 0 : 1;
+  }
+
+  if (parallel) {
+    if (num_traces == 0) {
+      fprintf(stderr, "--parallel needs at least one trace file\n");
+      exit(1);
+    }
+    int ok = run_parallel();
+    free(configs);
+    free(trace_paths);
+    return ok ? 0 : 1;
+  }
+
+  if (num_traces > 0) {
+    const char *path = trace_paths[num_traces - 1];
+    if (trace_is_binary(path)) {
+      // Use as a binary trace, replayed straight from the mapping
+      if (!trace_open(&trace, path)) {
+        exit(1);
+      }
+    } else if (use_cache) {
+      // Replayed from the decoded copy, made by this run on a miss
+      if (!trace_load(&trace, path)) {
+        exit(1);
+      }
     } else {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      if ((input = trace_fopen(path)) == NULL) {
+        exit(1);
+      }
+    }
+  }
+  // A profile's executions are counted off the simulation thread: by
+  // the reader of a text trace, or by profile_count_async() below for
+  // a mapped one. --verbose records every branch itself.
+  profile_t *counted = verbose ? NULL : profile;
+  if (trace.base == NULL && (stream = trace_stream_open(input, counted, skip_to)) == NULL) {
+    fprintf(stderr, "cannot start trace reader\n");
+    exit(1);
+  }
+
+  if (sweep) {
+    run_sweep();
+    if (stream != NULL && !trace_stream_close(stream)) {
+      fprintf(stderr, "error reading trace\n");
+      exit(1);
     }
+    trace_close(&trace);
+    free(configs);
+    free(trace_paths);
+    return 0;
   }
 
-  // Initialize the predictor
-  init_predictor();
+  // Initialize the predictor named last on the command line
+  if (predictor == NULL) {
+    predictor = create_predictor(&configs[num_configs - 1]);
+  }
+  predictor_set_lookahead(predictor, lookahead);
 
-  uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
+  uint64_t num_branches = 0;
+  uint64_t mispredictions = 0;
   uint32_t pc = 0;
   uint8_t outcome = NOTTAKEN;
 
+  if (interval_len > 0) {
+    interval_start(predictor);
+  }
+  if (sample_period > 0) {
+    sample_left = sample_period - sample_warmup - sample_measure;
+    if (sample_left == 0) {
+      sample_advance();
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  if (trace.base != NULL && counted != NULL) {
+    uint64_t begin = skip_to < trace.num_branches ? skip_to : trace.num_branches;
+    profile_count_async(counted, trace.pc, trace.outcome, begin, trace.num_branches);
+  }
+  if (trace.base != NULL && !verbose) {
+    // Binary trace: hand the whole mapping to the predictor's run loop
+    mispredictions = replay(predictor, trace.pc, trace.outcome, trace.num_branches, &num_branches);
+    trace_pos = trace.num_branches;
+  } else if (stream != NULL && !verbose) {
+    // Text trace: run each block as the reader thread delivers it
+    while ((block = trace_stream_next(stream)) != NULL) {
+      mispredictions += replay(predictor, block->pc, block->outcome,
+                               block->num_branches, &num_branches);
+      trace_stream_release(stream);
+    }
+  }
+
   // Reach each branch from the trace
   while (read_branch(&pc, &outcome)) {
+    if (trace_consumed < skip_to) {
+      trace_consumed++;
+      continue;
+    }
+    checkpoint_maybe(predictor);
+    trace_consumed++;
     num_branches++;
 
     // Make a prediction and compare with actual outcome
-    uint8_t prediction = make_prediction(pc);
+    uint8_t prediction = predictor_predict(predictor, pc);
     if (prediction != outcome) {
       mispredictions++;
     }
     if (verbose != 0) {
       printf ("%d\n", prediction);
     }
+    if (profile != NULL) {
+      profile_record(profile, pc, outcome, prediction);
+    }
+    if (interval_len > 0) {
+      interval_count(predictor, 1, prediction != outcome);
+    }
 
     // Train the predictor
-    train_predictor(pc, outcome);
+    predictor_train(predictor, pc, outcome);
+  }
+  if (profile != NULL) {
+    profile_wait(profile);
+  }
+  checkpoint_maybe(predictor);
+  if (checkpoint_path != NULL && !checkpoint_saved) {
+    fprintf(stderr, "checkpoint position %llu not reached\n",
+            (unsigned long long)checkpoint_at);
+  }
+
+  if (interval_len > 0) {
+    interval_emit(predictor);
+    if (interval_out != stdout) {
+      fclose(interval_out);
+    }
   }
 
   // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
-  float mispredict_rate = 100*((float)mispredictions / (float)num_branches);
-  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  if (sample_period > 0) {
+    if (num_samples == 0) {
+      fprintf(stderr, "trace too short for a single sample\n");
+      exit(1);
+    }
+    sample_report(num_branches);
+  } else {
+    printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+    printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions);
+    float mispredict_rate = 100*((float)mispredictions / (float)num_branches);
+    printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  }
+  if (timing) {
+    report_time(num_branches);
+  }
+  if (profile != NULL) {
+    profile_report(profile, profile_top, stdout);
+  }
 
   // Cleanup
-  fclose(stream);
-  free(buf);
+  predictor_destroy(predictor);
+  profile_destroy(profile);
+  if (stream != NULL && !trace_stream_close(stream)) {
+    fprintf(stderr, "error reading trace\n");
+    return 1;
+  }
+  trace_close(&trace);
+  free(configs);
+  free(trace_paths);
 
   return 0;
 }
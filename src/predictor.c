@@ -5,8 +5,12 @@
 //  Implement the various branch predictors below as      //
 //  described in the README                               //
 //========================================================//
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include "predictor.h"
+#include "counters.h"
 
 //
 // TODO:Student Information
@@ -20,8 +24,9 @@ const char *email       = "jiz282@ucsd.edu";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[5] = { "Static", "Gshare",
-                          "Tournament", "Custom", "TAGE" };
+const char *bpName[7] = { "Static", "Gshare",
+                          "Tournament", "Custom", "TAGE", "Perceptron",
+                          "Bimodal" };
 
 int ghistoryBits; // Number of bits used for Global History
 int lhistoryBits; // Number of bits used for Local History
@@ -39,14 +44,32 @@ int verbose;
 //
 
 // Gshare
-uint32_t ghr;
-uint8_t *gshare_bht;
+typedef struct {
+  int ghistoryBits;
+  uint32_t ghr;
+  uint8_t *gshare_bht;            // Packed 2-bit counters
+  table_arena_t arena;
+} gshare_t;
+
+// Bimodal
+typedef struct {
+  int indexBits;
+  uint8_t *bht;                   // Packed 2-bit counters
+  table_arena_t arena;
+} bimodal_t;
 
 // Tournament
-uint32_t *local_history_table;
-uint8_t *local_bht;
-uint8_t *global_bht;
-uint8_t *choice_table;
+typedef struct {
+  int ghistoryBits;
+  int lhistoryBits;
+  int pcIndexBits;
+  uint32_t ghr;
+  uint8_t *local_history_table;   // lhistoryBits wide fields
+  uint8_t *local_bht;             // Packed 2-bit counters
+  uint8_t *global_bht;            // Packed 2-bit counters
+  uint8_t *choice_table;          // Packed 2-bit counters
+  table_arena_t arena;
+} tournament_t;
 
 // Custom
 #define GLOBAL_HIST_BITS 13
@@ -55,386 +78,2235 @@ uint8_t *choice_table;
 #define GLOBAL_PHT_SIZE (1 << GLOBAL_HIST_BITS)
 #define LOCAL_HISTORY_TABLE_SIZE 1024
 
-uint16_t global_history = 0;
-
-uint8_t get_prediction(uint8_t counter) {
-    return counter >= WT ? TAKEN : NOTTAKEN;
-}
-
-uint8_t update_counter(uint8_t counter, uint8_t outcome) {
-    if (outcome == TAKEN) return (counter < ST) ? counter + 1 : ST;
-    else return (counter > SN) ? counter - 1 : SN;
-}
+typedef struct {
+  uint16_t global_history;
+  uint8_t *local_history_table;   // LOCAL_HIST_BITS wide histories
+  uint8_t *local_bht;             // Packed 2-bit counters
+  uint8_t *global_bht;            // Packed 2-bit counters
+  uint8_t *choice_table;          // Packed 2-bit counters
+  table_arena_t arena;
+} custom_t;
 
 
 
 // Add TAGE data structures after the Custom section
-// TAGE Predictor Configuration
-#define TAGE_NUM_COMPONENTS 4      // Reduced to 3 tagged tables + base
-#define TAGE_BASE_BITS 11          // Reduced to 2K entries
-#define TAGE_TAG_WIDTH 8           // Reduced tag width
+// TAGE Predictor Configuration; the geometry (components, table and
+// tag widths, history lengths) is set by the --tage parameters
+#define TAGE_MAX_COMPONENTS PREDICTOR_MAX_COMPONENTS  // Base + up to 15 tagged tables
+#define TAGE_MAX_TABLE_BITS 20     // Largest tagged or base table, log2
+#define TAGE_MAX_TAG_WIDTH 16      // Tags are held in 16 bits
 #define TAGE_USEFUL_BITS 2         // Keep same
-#define TAGE_TABLE_BITS 10         // 1K entries per tagged table
+#define TAGE_HIST_BUFFER 1024      // Circular global history, > the longest history
+#define TAGE_DECAY_PERIOD 16384    // Mispredictions between useful-bit aging passes
+#define TAGE_DECAY_STRIDE 8        // Entries aged per table per branch during a pass
+
+// Optional TAGE-SC-L components, each sized by a --tage parameter and
+// left out when that parameter is 0
+#define TAGE_MAX_USE_ALT_BITS 8    // use_alt_on_na counter width
+#define TAGE_MAX_LOOP_BITS 16      // Loop predictor entries, log2
+#define TAGE_LOOP_TAG_BITS 10
+#define TAGE_LOOP_ITER_BITS 14     // Iteration and trip counts
+#define TAGE_LOOP_CONF_MAX 3       // Trip count seen this many times in a row
+#define TAGE_LOOP_AGE_MAX 255
+#define TAGE_LOOP_MIN_TRIP 3       // Shorter loops are left to TAGE
+#define TAGE_WITH_LOOP_BITS 7      // Confidence in the loop predictor
+#define TAGE_SC_TABLES 5           // Bias table + GEHL tables
+#define TAGE_SC_CTR_BITS 6
+#define TAGE_SC_THRESHOLD_INIT 12  // Initial override threshold
+#define TAGE_SC_TC_BITS 7          // Threshold adaptation counter
+
+// GEHL history lengths of the corrector tables; table 0 is the bias
+// table, indexed by the PC and the prediction being corrected
+static const int tage_sc_history[TAGE_SC_TABLES] = { 0, 4, 8, 16, 32 };
+
+// Folded (circular shift) history register: the newest 'orig_len'
+// history bits XOR-folded down to 'comp_len' bits, maintained in
+// O(1) per branch instead of refolding the whole history
+typedef struct {
+  uint32_t comp;     // Folded value
+  int comp_len;      // Width of the folded value
+  int orig_len;      // History length being folded
+  int outpoint;      // Position the evicted bit leaves from
+} folded_history_t;
 
-// TAGE table entry structure
+// Loop predictor entry: a loop body runs in direction 'dir' for 'trip'
+// iterations (counting the exit) before one branch the other way
 typedef struct {
-    uint8_t ctr;       // 3-bit prediction counter
-    uint16_t tag;      // Tag for partial matching
-    uint8_t useful;    // 2-bit useful counter
-} tage_entry_t;
+  uint16_t tag;
+  uint16_t iter;     // Iterations of the current pass
+  uint16_t trip;     // Iterations of the last complete pass, 0 if unknown
+  uint8_t conf;      // Passes in a row with the same trip count
+  uint8_t age;       // Replaceable at 0
+  uint8_t dir;
+} tage_loop_t;
 
 // TAGE predictor state
+//
+// The tagged tables live in one arena as separate arrays of tags,
+// prediction counters and useful counters, each table a contiguous
+// run within its array, next to the base predictor and history. The
+// tag-match scan over all components then reads only tags, and aging
+// walks a dense run of useful counters.
 typedef struct {
-    uint8_t *base_predictor;              // Bimodal base predictor
-    tage_entry_t **tables;                // Tagged tables
-    int *history_lengths;                 // History lengths for each table
-    int *table_sizes;                     // Size of each table
-    uint64_t global_history;              // Global history register
-    int *table_indices;                   // Current indices for each table
-    uint16_t *table_tags;                 // Current tags for each table
-    int provider_component;               // Which component provided prediction
-    int altpred_component;                // Alternative prediction component
-    uint8_t provider_pred;                // Provider's prediction
-    uint8_t altpred;                      // Alternative prediction
+  uint8_t *base_predictor;              // Bimodal base predictor (packed)
+  int num_components;                   // Base predictor + tagged tables
+  int table_bits;                       // log2 entries per tagged table
+  int tag_width;                        // Tag bits per tagged entry
+  table_arena_t arena;                  // Backs the base, tagged tables and history
+  uint16_t *tags;                       // Tags of all tagged tables
+  uint8_t *ctrs;                        // 3-bit prediction counters
+  uint8_t *useful;                      // 2-bit useful counters
+  uint32_t table_base[TAGE_MAX_COMPONENTS];  // First entry of each table
+  int *history_lengths;                 // History lengths for each table
+  int *table_sizes;                     // Size of each table
+  int decay_tick;                       // Mispredictions since the last aging pass
+  int decay_cursor;                     // Next entry to age, -1 when idle
+  uint8_t *ghist;                       // Circular buffer of all outcomes
+  int ghist_ptr;                        // Position of the newest outcome
+  folded_history_t *index_fold;         // Per-table index folding
+  folded_history_t *tag_fold[2];        // Per-table tag folding
+  uint32_t slots[TAGE_MAX_COMPONENTS];  // Current arena entry for each table
+  uint16_t table_tags[TAGE_MAX_COMPONENTS];  // Current tags for each table
+  int provider_component;               // Which component provided prediction
+  int altpred_component;                // Alternative prediction component
+  uint8_t provider_pred;                // Provider's prediction
+  uint8_t altpred;                      // Alternative prediction
+  uint64_t provider_hits[TAGE_MAX_COMPONENTS];  // Predictions per provider
+  int max_history;                      // Longest history any fold reads
+
+  // Alternate prediction for newly allocated providers
+  int use_alt_bits;                     // Counter width, 0 if off
+  int use_alt_on_na;                    // Use the alternate while >= 0
+  uint8_t provider_new;                 // Provider entry is weak and not useful
+  uint8_t tage_pred;                    // TAGE's prediction
+
+  // Loop predictor
+  int loop_bits;                        // log2 entries, 0 if off
+  tage_loop_t *loop;
+  uint32_t loop_slot;                   // Entry for the current branch
+  uint16_t loop_tag;                    // Its tag
+  uint8_t loop_hit;
+  uint8_t loop_valid;                   // Hit with a confident trip count
+  uint8_t loop_pred;
+  int with_loop;                        // Override TAGE while >= 0
+
+  // Statistical corrector
+  int sc_bits;                          // log2 entries per table, 0 if off
+  int8_t *sc;                           // Counters, table after table
+  folded_history_t sc_fold[TAGE_SC_TABLES];
+  uint32_t sc_slots[TAGE_SC_TABLES];
+  int sc_sum;
+  uint8_t sc_input;                     // Prediction being corrected
+  int sc_threshold;
+  int sc_tc;
+  uint8_t prediction;                   // Final prediction
 } tage_predictor_t;
 
-tage_predictor_t tage;
+// Perceptron
+#define PERCEPTRON_LANES 32        // Weight vectors are padded to whole AVX2 registers
+#define PERCEPTRON_MAX_HIST 255
+#define PERCEPTRON_MAX_ROWS 65536
+#define PERCEPTRON_WEIGHT_MAX 127  // Symmetric so negating a weight cannot overflow
+
+// One int8 weight vector per row, stored back to back. Lane 0 is the
+// bias, lanes 1..historyBits weight the global history (newest first)
+// and the padding lanes stay zero. The history is kept as a vector of
+// the same layout holding +1 (bias), +-1 per outcome and 0 padding,
+// so prediction and training are straight vector operations.
+typedef struct perceptron perceptron_t;
+struct perceptron {
+  int historyBits;
+  int rows;
+  uint32_t row_mask;                     // rows - 1 when a power of two, else 0
+  int width;                             // Lanes per weight vector
+  int theta;                             // Training threshold
+  int8_t *weights;                       // rows x width
+  int8_t *history;                       // width lanes
+  int8_t *history_base;                  // Table behind 'history'
+  int8_t *shift_mask;                    // Lanes kept when shifting the history
+  table_arena_t arena;
+  uint8_t (*step)(perceptron_t *p, int8_t *w, uint8_t outcome);
+};
+
+// A predictor instance: the registry entry it was built from plus the
+// state that entry's init() allocated
+struct predictor {
+  const predictor_ops_t *ops;
+  void *state;
+  predictor_config_t cfg;
+  predictor_kernel_t kernel;     // Specialized run loop, NULL if none
+  int lookahead;                 // Prefetch distance, 0 for none
+};
+
+// Instance driven by init_predictor()/make_prediction()/train_predictor()
+static predictor_t *default_predictor;
 
 
 //------------------------------------//
 //        Predictor Functions         //
 //------------------------------------//
 
-// TAGE helper functions
-uint32_t tage_hash(uint32_t pc, uint64_t history, int hist_len) {
-    uint64_t result = pc;
-    for (int i = 0; i < hist_len; i++) {
-        if (history & (1ULL << i)) {
-            result ^= (pc >> (i % 16));
-        }
-    }
-    return result;
+// Hooks for the run loops below, which are stamped out twice: with
+// MISSED_SKIP, and with MISSED_RECORD, which stores every PC at the
+// end of 'missed' and keeps it only if the branch was mispredicted
+// (no branch on the outcome). The copy is picked once per call, so a
+// run that does not collect them carries no extra code at all.
+#define MISSED_SKIP(PC)
+#define MISSED_RECORD(PC) missed[mispredictions] = (PC)
+
+#define PREDICTOR_RUN_LOOP(STEP, RECORD)                                  \
+  for (uint64_t i = begin; i < end; i++) {                                \
+    uint8_t taken = (outcome[i >> 3] >> (i & 7)) & 1;                     \
+    uint8_t prediction = STEP(state, pc[i], taken);                       \
+    RECORD(pc[i]);                                                        \
+    mispredictions += prediction != taken;                                \
+  }
+
+// Batched predict+train loop over a fused 'STEP' function (predicts,
+// trains and returns the prediction). Mispredictions are counted and,
+// if 'missed' is non-NULL, their PCs are stored in it.
+#define PREDICTOR_RUN(NAME, STEP)                                         \
+static uint32_t                                                           \
+NAME(void *state, const uint32_t *pc, const uint8_t *outcome,             \
+     uint64_t begin, uint64_t end, uint32_t *missed)                      \
+{                                                                         \
+  uint32_t mispredictions = 0;                                            \
+  if (missed == NULL) {                                                   \
+    PREDICTOR_RUN_LOOP(STEP, MISSED_SKIP)                                 \
+  } else {                                                                \
+    PREDICTOR_RUN_LOOP(STEP, MISSED_RECORD)                               \
+  }                                                                       \
+  return mispredictions;                                                  \
 }
 
-uint16_t tage_compute_tag(uint32_t pc, uint64_t history, int hist_len) {
-    uint32_t tag = pc ^ (pc >> hist_len);
-    uint64_t hist_compressed = history;
-    for (int i = 0; i < hist_len; i += TAGE_TAG_WIDTH) {
-        tag ^= (hist_compressed & ((1 << TAGE_TAG_WIDTH) - 1));
-        hist_compressed >>= TAGE_TAG_WIDTH;
-    }
-    return tag & ((1 << TAGE_TAG_WIDTH) - 1);
+#define PREDICTOR_AHEAD_LOOP(STEP, AHEAD, RECORD)                         \
+  for (uint64_t i = begin; i < end; i++) {                                \
+    if (next < end) {                                                     \
+      AHEAD(state, &ahead, pc[next], (outcome[next >> 3] >> (next & 7)) & 1); \
+      next++;                                                             \
+    }                                                                     \
+    uint8_t taken = (outcome[i >> 3] >> (i & 7)) & 1;                     \
+    uint8_t prediction = STEP(state, pc[i], taken);                       \
+    RECORD(pc[i]);                                                        \
+    mispredictions += prediction != taken;                                \
+  }
+
+// PREDICTOR_RUN() that runs a second copy of the index computation
+// 'distance' branches ahead of the predictions, on the outcomes the
+// trace already holds. 'START' copies the history into an 'AHEAD_T'
+// and returns the distance it can look ahead (at most 'distance');
+// 'AHEAD' prefetches the entries one branch will use and shifts its
+// outcome into the copy. The copy never reads past 'end', so the
+// predictor state after a run is exactly that of PREDICTOR_RUN().
+#define PREDICTOR_RUN_AHEAD(NAME, STEP, AHEAD_T, START, AHEAD)           \
+static uint32_t                                                           \
+NAME(void *state, const uint32_t *pc, const uint8_t *outcome,             \
+     uint64_t begin, uint64_t end, uint32_t *missed, int distance)        \
+{                                                                         \
+  AHEAD_T ahead;                                                          \
+  uint64_t next = begin;                                                  \
+  uint64_t primed = begin + START(state, &ahead, distance);               \
+  for (; next < end && next < primed; next++) {                           \
+    AHEAD(state, &ahead, pc[next], (outcome[next >> 3] >> (next & 7)) & 1); \
+  }                                                                       \
+  uint32_t mispredictions = 0;                                            \
+  if (missed == NULL) {                                                   \
+    PREDICTOR_AHEAD_LOOP(STEP, AHEAD, MISSED_SKIP)                        \
+  } else {                                                                \
+    PREDICTOR_AHEAD_LOOP(STEP, AHEAD, MISSED_RECORD)                      \
+  }                                                                       \
+  return mispredictions;                                                  \
 }
 
-// Initialize the predictor
+// Copy 'n' bytes of state at 'data' to the checkpoint 'f', or back
+// from it when 'load' is set
 //
-void init_predictor()
-{
-  switch (bpType) {
-    case GSHARE:
-      ghr = 0;
-      gshare_bht = (uint8_t *)malloc(sizeof(uint8_t) * (1 << ghistoryBits));
-      for (int i = 0; i < (1 << ghistoryBits); i++)
-        gshare_bht[i] = WN;
-      break;
-
-    case TOURNAMENT:
-      ghr = 0;
-      local_history_table = (uint32_t *)malloc(sizeof(uint32_t) * (1 << pcIndexBits));
-      local_bht = (uint8_t *)malloc(sizeof(uint8_t) * (1 << lhistoryBits));
-      global_bht = (uint8_t *)malloc(sizeof(uint8_t) * (1 << ghistoryBits));
-      choice_table = (uint8_t *)malloc(sizeof(uint8_t) * (1 << ghistoryBits));
-
-      for (int i = 0; i < (1 << pcIndexBits); i++) local_history_table[i] = 0;
-      for (int i = 0; i < (1 << lhistoryBits); i++) local_bht[i] = WN;
-      for (int i = 0; i < (1 << ghistoryBits); i++) {
-        global_bht[i] = WN;
-        choice_table[i] = WT;
-      }
-      break;
+// Returns True if Successful
+//
+static int
+checkpoint_io(FILE *f, void *data, size_t n, int load)
+{
+  return load ? fread(data, 1, n, f) == n : fwrite(data, 1, n, f) == n;
+}
 
-    case CUSTOM:
-      global_bht = (uint8_t *)malloc(sizeof(uint8_t) * GLOBAL_PHT_SIZE);
-      choice_table = (uint8_t *)malloc(sizeof(uint8_t) * GLOBAL_PHT_SIZE);
-      local_bht = (uint8_t *)malloc(sizeof(uint8_t) * LOCAL_PHT_SIZE);
-      local_history_table = (uint32_t *)malloc(sizeof(uint32_t) * LOCAL_HISTORY_TABLE_SIZE);
+//
+// Static
+//
 
-      for (int i = 0; i < GLOBAL_PHT_SIZE; i++) {
-        global_bht[i] = WN;
-        choice_table[i] = WT;
-      }
-      for (int i = 0; i < LOCAL_PHT_SIZE; i++) local_bht[i] = WN;
-      for (int i = 0; i < LOCAL_HISTORY_TABLE_SIZE; i++) local_history_table[i] = 0;
-      break;
-
-    case TAGE:
-    // Initialize history lengths (adjusted for 4 components)
-    tage.history_lengths = (int*)malloc(sizeof(int) * TAGE_NUM_COMPONENTS);
-    tage.history_lengths[0] = 0;   // Base predictor
-    tage.history_lengths[1] = 4;   // Shorter histories
-    tage.history_lengths[2] = 16;
-    tage.history_lengths[3] = 100;
-    
-    // Initialize table sizes
-    tage.table_sizes = (int*)malloc(sizeof(int) * TAGE_NUM_COMPONENTS);
-    tage.table_sizes[0] = 1 << TAGE_BASE_BITS;  // 2K entries for base
-    for (int i = 1; i < TAGE_NUM_COMPONENTS; i++) {
-      tage.table_sizes[i] = 1 << TAGE_TABLE_BITS;  // 1K entries
-    }
-    
-    // Allocate base predictor
-    tage.base_predictor = (uint8_t*)malloc(sizeof(uint8_t) * tage.table_sizes[0]);
-    for (int i = 0; i < tage.table_sizes[0]; i++) {
-      tage.base_predictor[i] = WN;
-    }
-    
-    // Allocate tagged tables
-    tage.tables = (tage_entry_t**)malloc(sizeof(tage_entry_t*) * TAGE_NUM_COMPONENTS);
-    for (int i = 1; i < TAGE_NUM_COMPONENTS; i++) {
-      tage.tables[i] = (tage_entry_t*)malloc(sizeof(tage_entry_t) * tage.table_sizes[i]);
-      for (int j = 0; j < tage.table_sizes[i]; j++) {
-        tage.tables[i][j].ctr = WN;
-        tage.tables[i][j].tag = 0;
-        tage.tables[i][j].useful = 0;
-      }
-    }
-    
-    // Initialize other state
-    tage.global_history = 0;
-    tage.table_indices = (int*)malloc(sizeof(int) * TAGE_NUM_COMPONENTS);
-    tage.table_tags = (uint16_t*)malloc(sizeof(uint16_t) * TAGE_NUM_COMPONENTS);
-    break;
+static void *
+static_init(const int *params)
+{
+  // No state, but NULL would report a failure
+  static int static_state;
+  return &static_state;
+}
 
-  }
+static uint8_t
+static_predict(void *state, uint32_t pc)
+{
+  return TAKEN;
 }
 
+static void
+static_train(void *state, uint32_t pc, uint8_t outcome)
+{
+}
+
+static inline uint8_t
+static_step(void *state, uint32_t pc, uint8_t outcome)
+{
+  return TAKEN;
+}
+
+PREDICTOR_RUN(static_run, static_step)
+
+static void
+static_destroy(void *state)
+{
+}
+
+static uint64_t
+static_bits(const int *params)
+{
+  return 0;
+}
+
+static size_t
+static_host_bytes(const void *state)
+{
+  return 0;
+}
+
+static void
+static_reset(void *state)
+{
+}
+
+static int
+static_checkpoint(void *state, FILE *f, int load)
+{
+  return 1;
+}
 
-// Make a prediction for conditional branch instruction at PC 'pc'
-// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
-// indicates a prediction of not taken
 //
-uint8_t
-make_prediction(uint32_t pc)
+// Gshare
+//
+
+static void
+gshare_reset(void *state)
 {
-  //
-  //TODO: Implement prediction scheme
-  //
-
-  // Make a prediction based on the bpType
-  switch (bpType) {
-    case STATIC:
-      return TAKEN;
-    case GSHARE: {
-      uint32_t index = (pc ^ ghr) & ((1 << ghistoryBits) - 1);
-      return gshare_bht[index] >= WT ? TAKEN : NOTTAKEN;
-    }
-    case TOURNAMENT: {
-      uint32_t global_index = ghr & ((1 << ghistoryBits) - 1);
-      uint32_t local_index = pc & ((1 << pcIndexBits) - 1);
-      uint32_t local_history = local_history_table[local_index];
-      uint32_t local_bht_index = local_history & ((1 << lhistoryBits) - 1);
+  gshare_t *g = (gshare_t *)state;
+  g->ghr = 0;
+  ctr2_fill(g->gshare_bht, 1 << g->ghistoryBits, WN);
+}
 
-      uint8_t local_pred = local_bht[local_bht_index] >= WT ? TAKEN : NOTTAKEN;
-      uint8_t global_pred = global_bht[global_index] >= WT ? TAKEN : NOTTAKEN;
+static void *
+gshare_init(const int *params)
+{
+  gshare_t *g = (gshare_t *)malloc(sizeof(gshare_t));
+  g->ghistoryBits = params[0];
+  if (!table_arena_init(&g->arena, table_bytes(ctr2_bytes(1 << g->ghistoryBits)))) {
+    free(g);
+    return NULL;
+  }
+  g->gshare_bht = (uint8_t *)table_arena_take(&g->arena, ctr2_bytes(1 << g->ghistoryBits));
+  gshare_reset(g);
+  return g;
+}
 
-      return choice_table[global_index] >= WT ? global_pred : local_pred;
-    }
-    case CUSTOM: {
-      uint32_t global_idx = global_history & (GLOBAL_PHT_SIZE - 1);
-      uint32_t local_idx = pc & (LOCAL_HISTORY_TABLE_SIZE - 1);
-      uint8_t local_hist = local_history_table[local_idx];
+static uint8_t
+gshare_predict(void *state, uint32_t pc)
+{
+  gshare_t *g = (gshare_t *)state;
+  uint32_t index = (pc ^ g->ghr) & ((1 << g->ghistoryBits) - 1);
+  return ctr2_predict(g->gshare_bht, index);
+}
 
-      uint8_t local_pred = get_prediction(local_bht[local_hist]);
-      uint8_t global_pred = get_prediction(global_bht[global_idx]);
+// Predict and train in one step, computing the index once
+static inline uint8_t
+gshare_step(void *state, uint32_t pc, uint8_t outcome)
+{
+  gshare_t *g = (gshare_t *)state;
+  uint32_t index = (pc ^ g->ghr) & ((1 << g->ghistoryBits) - 1);
+  uint8_t prediction = ctr2_predict(g->gshare_bht, index);
+  ctr2_update(g->gshare_bht, index, outcome);
+  g->ghr = ((g->ghr << 1) | outcome) & ((1 << g->ghistoryBits) - 1);
+  return prediction;
+}
 
-      return (choice_table[global_idx] >= WT) ? global_pred : local_pred;
-    }
-    case TAGE: {
-      // Compute indices and tags for all components
-      tage.table_indices[0] = pc & (tage.table_sizes[0] - 1);
-      for (int i = 1; i < TAGE_NUM_COMPONENTS; i++) {
-        uint32_t index = tage_hash(pc, tage.global_history, tage.history_lengths[i]);
-        tage.table_indices[i] = index & (tage.table_sizes[i] - 1);
-        tage.table_tags[i] = tage_compute_tag(pc, tage.global_history, tage.history_lengths[i]);
-      }
-      
-      // Find longest matching component
-      tage.provider_component = 0;
-      tage.altpred_component = 0;
-      
-      for (int i = TAGE_NUM_COMPONENTS - 1; i > 0; i--) {
-        if (tage.tables[i][tage.table_indices[i]].tag == tage.table_tags[i]) {
-          tage.provider_component = i;
-          break;
-        }
-      }
-      
-      // Find alternative prediction
-      for (int i = tage.provider_component - 1; i >= 0; i--) {
-        if (i == 0 || tage.tables[i][tage.table_indices[i]].tag == tage.table_tags[i]) {
-          tage.altpred_component = i;
-          break;
-        }
-      }
-      
-      // Get predictions
-      if (tage.provider_component == 0) {
-        tage.provider_pred = tage.base_predictor[tage.table_indices[0]] >= WT ? TAKEN : NOTTAKEN;
-      } else {
-        tage.provider_pred = tage.tables[tage.provider_component][tage.table_indices[tage.provider_component]].ctr >= 4 ? TAKEN : NOTTAKEN;
-      }
-      
-      if (tage.altpred_component == 0) {
-        tage.altpred = tage.base_predictor[tage.table_indices[0]] >= WT ? TAKEN : NOTTAKEN;
-      } else {
-        tage.altpred = tage.tables[tage.altpred_component][tage.table_indices[tage.altpred_component]].ctr >= 4 ? TAKEN : NOTTAKEN;
-      }
-      
-      // Use provider prediction
-      return tage.provider_pred;
-    }
-    default:
-      break;
+static void
+gshare_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  gshare_step(state, pc, outcome);
+}
+
+PREDICTOR_RUN(gshare_run, gshare_step)
+
+static inline int
+gshare_ahead_start(void *state, uint32_t *ghr, int distance)
+{
+  *ghr = ((gshare_t *)state)->ghr;
+  return distance;
+}
+
+static inline void
+gshare_ahead(void *state, uint32_t *ghr, uint32_t pc, uint8_t outcome)
+{
+  gshare_t *g = (gshare_t *)state;
+  uint32_t index = (pc ^ *ghr) & ((1 << g->ghistoryBits) - 1);
+  __builtin_prefetch(&g->gshare_bht[index >> 2], 1);
+  *ghr = ((*ghr << 1) | outcome) & ((1 << g->ghistoryBits) - 1);
+}
+
+PREDICTOR_RUN_AHEAD(gshare_run_ahead, gshare_step, uint32_t,
+                    gshare_ahead_start, gshare_ahead)
+
+static void
+gshare_destroy(void *state)
+{
+  gshare_t *g = (gshare_t *)state;
+  table_arena_release(&g->arena);
+  free(g);
+}
+
+// 2-bit counters plus the history register
+static uint64_t
+gshare_bits(const int *params)
+{
+  return 2 * ((uint64_t)1 << params[0]) + params[0];
+}
+
+static size_t
+gshare_host_bytes(const void *state)
+{
+  const gshare_t *g = (const gshare_t *)state;
+  return sizeof(gshare_t) + g->arena.size;
+}
+
+static int
+gshare_checkpoint(void *state, FILE *f, int load)
+{
+  gshare_t *g = (gshare_t *)state;
+  return checkpoint_io(f, &g->ghr, sizeof(g->ghr), load) &&
+         checkpoint_io(f, g->gshare_bht, ctr2_bytes(1 << g->ghistoryBits), load);
+}
+
+#ifdef SPECIALIZED_KERNELS
+// Stamp out a fused predict+train loop for a fixed history length so
+// the index mask folds to a constant and the index is computed once
+#define GSHARE_KERNEL_LOOP(BITS, RECORD)                                  \
+  for (uint64_t i = begin; i < end; i++) {                                \
+    uint8_t taken = (outcome[i >> 3] >> (i & 7)) & 1;                     \
+    uint32_t index = (pc[i] ^ ghr) & ((1u << BITS) - 1);                  \
+    uint8_t prediction = ctr2_predict(bht, index);                        \
+    RECORD(pc[i]);                                                        \
+    mispredictions += prediction != taken;                                \
+    ctr2_update(bht, index, taken);                                       \
+    ghr = ((ghr << 1) | taken) & ((1u << BITS) - 1);                      \
   }
 
-  // If there is not a compatable bpType then return NOTTAKEN
-  return NOTTAKEN;
+#define GSHARE_KERNEL(BITS)                                               \
+static uint32_t                                                           \
+gshare_kernel_##BITS(void *state, const uint32_t *pc,                     \
+                     const uint8_t *outcome, uint64_t begin, uint64_t end, \
+                     uint32_t *missed)                                    \
+{                                                                         \
+  gshare_t *g = (gshare_t *)state;                                        \
+  uint8_t *bht = g->gshare_bht;                                           \
+  uint32_t ghr = g->ghr;                                                  \
+  uint32_t mispredictions = 0;                                            \
+  if (missed == NULL) {                                                   \
+    GSHARE_KERNEL_LOOP(BITS, MISSED_SKIP)                                 \
+  } else {                                                                \
+    GSHARE_KERNEL_LOOP(BITS, MISSED_RECORD)                               \
+  }                                                                       \
+  g->ghr = ghr;                                                           \
+  return mispredictions;                                                  \
 }
 
-// Train the predictor the last executed branch at PC 'pc' and with
-// outcome 'outcome' (true indicates that the branch was taken, false
-// indicates that the branch was not taken)
+GSHARE_KERNEL(10) GSHARE_KERNEL(11) GSHARE_KERNEL(12) GSHARE_KERNEL(13)
+GSHARE_KERNEL(14) GSHARE_KERNEL(15) GSHARE_KERNEL(16) GSHARE_KERNEL(17)
+GSHARE_KERNEL(18) GSHARE_KERNEL(19) GSHARE_KERNEL(20)
+
+static const predictor_kernel_t gshare_kernels[] = {
+  gshare_kernel_10, gshare_kernel_11, gshare_kernel_12, gshare_kernel_13,
+  gshare_kernel_14, gshare_kernel_15, gshare_kernel_16, gshare_kernel_17,
+  gshare_kernel_18, gshare_kernel_19, gshare_kernel_20,
+};
+#endif
+
+static predictor_kernel_t
+gshare_select_kernel(const int *params)
+{
+#ifdef SPECIALIZED_KERNELS
+  if (params[0] >= 10 && params[0] <= 20) {
+    return gshare_kernels[params[0] - 10];
+  }
+#endif
+  return NULL;
+}
+
+//
+// Bimodal
 //
-void train_predictor(uint32_t pc, uint8_t outcome)
+
+static void
+bimodal_reset(void *state)
 {
-  switch (bpType) {
-    case GSHARE: {
-      uint32_t index = (pc ^ ghr) & ((1 << ghistoryBits) - 1);
-      if (outcome == TAKEN) {
-        if (gshare_bht[index] < ST) gshare_bht[index]++;
-      } else {
-        if (gshare_bht[index] > SN) gshare_bht[index]--;
-      }
-      ghr = ((ghr << 1) | outcome) & ((1 << ghistoryBits) - 1);
-      break;
-    }
+  bimodal_t *b = (bimodal_t *)state;
+  ctr2_fill(b->bht, 1 << b->indexBits, WN);
+}
 
-    case TOURNAMENT: {
-      uint32_t global_index = ghr & ((1 << ghistoryBits) - 1);
-      uint32_t local_index = pc & ((1 << pcIndexBits) - 1);
-      uint32_t local_history = local_history_table[local_index];
-      uint32_t local_bht_index = local_history & ((1 << lhistoryBits) - 1);
+static void *
+bimodal_init(const int *params)
+{
+  bimodal_t *b = (bimodal_t *)malloc(sizeof(bimodal_t));
+  b->indexBits = params[0];
+  if (!table_arena_init(&b->arena, table_bytes(ctr2_bytes(1 << b->indexBits)))) {
+    free(b);
+    return NULL;
+  }
+  b->bht = (uint8_t *)table_arena_take(&b->arena, ctr2_bytes(1 << b->indexBits));
+  bimodal_reset(b);
+  return b;
+}
 
-      uint8_t local_pred = local_bht[local_bht_index] >= WT ? TAKEN : NOTTAKEN;
-      uint8_t global_pred = global_bht[global_index] >= WT ? TAKEN : NOTTAKEN;
+static uint8_t
+bimodal_predict(void *state, uint32_t pc)
+{
+  bimodal_t *b = (bimodal_t *)state;
+  return ctr2_predict(b->bht, pc & ((1 << b->indexBits) - 1));
+}
 
-      if (outcome == TAKEN) {
-        if (local_bht[local_bht_index] < ST) local_bht[local_bht_index]++;
-      } else {
-        if (local_bht[local_bht_index] > SN) local_bht[local_bht_index]--;
-      }
-      if (outcome == TAKEN) {
-        if (global_bht[global_index] < ST) global_bht[global_index]++;
-      } else {
-        if (global_bht[global_index] > SN) global_bht[global_index]--;
-      }
-      if (local_pred != global_pred) {
-        if (global_pred == outcome)
-          choice_table[global_index] = (choice_table[global_index] < ST) ? choice_table[global_index] + 1 : ST;
-        else
-          choice_table[global_index] = (choice_table[global_index] > SN) ? choice_table[global_index] - 1 : SN;
-      }
-      local_history_table[local_index] = ((local_history << 1) | outcome) & ((1 << lhistoryBits) - 1);
-      ghr = ((ghr << 1) | outcome) & ((1 << ghistoryBits) - 1);
-      break;
-    }
+static inline uint8_t
+bimodal_step(void *state, uint32_t pc, uint8_t outcome)
+{
+  bimodal_t *b = (bimodal_t *)state;
+  uint32_t index = pc & ((1 << b->indexBits) - 1);
+  uint8_t prediction = ctr2_predict(b->bht, index);
+  ctr2_update(b->bht, index, outcome);
+  return prediction;
+}
 
-    case CUSTOM:{
-      uint32_t global_idx = global_history & (GLOBAL_PHT_SIZE - 1);
-      uint32_t local_idx = pc & (LOCAL_HISTORY_TABLE_SIZE - 1);
-      uint8_t local_hist = local_history_table[local_idx];
+static void
+bimodal_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  bimodal_step(state, pc, outcome);
+}
 
-      uint8_t local_pred = get_prediction(local_bht[local_hist]);
-      uint8_t global_pred = get_prediction(global_bht[global_idx]);
+PREDICTOR_RUN(bimodal_run, bimodal_step)
 
-      local_bht[local_hist] = update_counter(local_bht[local_hist], outcome);
-      global_bht[global_idx] = update_counter(global_bht[global_idx], outcome);
+// The index needs no history, so there is nothing to run ahead
+static inline int
+bimodal_ahead_start(void *state, int *unused, int distance)
+{
+  return distance;
+}
 
-      if (local_pred != global_pred) {
-        if (global_pred == outcome && choice_table[global_idx] < ST)
-          choice_table[global_idx]++;
-        else if (local_pred == outcome && choice_table[global_idx] > SN)
-          choice_table[global_idx]--;
-      }
-      local_history_table[local_idx] = ((local_hist << 1) | outcome) & (LOCAL_PHT_SIZE - 1);
-      global_history = ((global_history << 1) | outcome) & (GLOBAL_PHT_SIZE - 1);
-      break;
-    }
+static inline void
+bimodal_ahead(void *state, int *unused, uint32_t pc, uint8_t outcome)
+{
+  bimodal_t *b = (bimodal_t *)state;
+  __builtin_prefetch(&b->bht[(pc & ((1 << b->indexBits) - 1)) >> 2], 1);
+}
 
-    case TAGE: {
-    // Update provider component
-    if (tage.provider_component == 0) {
-      // Update base predictor
-      if (outcome == TAKEN) {
-        if (tage.base_predictor[tage.table_indices[0]] < ST)
-          tage.base_predictor[tage.table_indices[0]]++;
-      } else {
-        if (tage.base_predictor[tage.table_indices[0]] > SN)
-          tage.base_predictor[tage.table_indices[0]]--;
-      }
-    } else {
-      // Update tagged table entry
-      tage_entry_t *entry = &tage.tables[tage.provider_component][tage.table_indices[tage.provider_component]];
-      if (outcome == TAKEN) {
-        if (entry->ctr < 7) entry->ctr++;
-      } else {
-        if (entry->ctr > 0) entry->ctr--;
-      }
-      
-      // Update useful counter
-      if (tage.provider_pred != tage.altpred) {
-        if (tage.provider_pred == outcome && entry->useful < 3) {
-          entry->useful++;
-        } else if (tage.provider_pred != outcome && entry->useful > 0) {
-          entry->useful--;
-        }
-      }
-    }
-    
-    // Allocate new entries on misprediction
-    if (tage.provider_pred != outcome) {
-      // Find a table to allocate in
-      for (int i = tage.provider_component + 1; i < TAGE_NUM_COMPONENTS; i++) {
-        tage_entry_t *entry = &tage.tables[i][tage.table_indices[i]];
-        
-        // Check if entry is available (useful == 0)
-        if (entry->useful == 0) {
-          entry->tag = tage.table_tags[i];
-          entry->ctr = (outcome == TAKEN) ? 4 : 3;
-          entry->useful = 0;
-          break;
-        }
-      }
-      
-      // Decay useful counters periodically
-      if ((tage.global_history & 0xFF) == 0xFF) {
-        for (int i = 1; i < TAGE_NUM_COMPONENTS; i++) {
-          for (int j = 0; j < tage.table_sizes[i]; j++) {
-            if (tage.tables[i][j].useful > 0) {
-              tage.tables[i][j].useful--;
-            }
-          }
-        }
-      }
-    }
-    
-    // Update global history
-    tage.global_history = (tage.global_history << 1) | outcome;
-    break;
+PREDICTOR_RUN_AHEAD(bimodal_run_ahead, bimodal_step, int,
+                    bimodal_ahead_start, bimodal_ahead)
+
+static void
+bimodal_destroy(void *state)
+{
+  bimodal_t *b = (bimodal_t *)state;
+  table_arena_release(&b->arena);
+  free(b);
+}
+
+// 2-bit counters only
+static uint64_t
+bimodal_bits(const int *params)
+{
+  return 2 * ((uint64_t)1 << params[0]);
+}
+
+static size_t
+bimodal_host_bytes(const void *state)
+{
+  const bimodal_t *b = (const bimodal_t *)state;
+  return sizeof(bimodal_t) + b->arena.size;
+}
+
+static int
+bimodal_checkpoint(void *state, FILE *f, int load)
+{
+  bimodal_t *b = (bimodal_t *)state;
+  return checkpoint_io(f, b->bht, ctr2_bytes(1 << b->indexBits), load);
+}
+
+//
+// Tournament
+//
+
+static void
+tournament_reset(void *state)
+{
+  tournament_t *t = (tournament_t *)state;
+  t->ghr = 0;
+  memset(t->local_history_table, 0, bitfield_bytes(1 << t->pcIndexBits, t->lhistoryBits));
+  ctr2_fill(t->local_bht, 1 << t->lhistoryBits, WN);
+  ctr2_fill(t->global_bht, 1 << t->ghistoryBits, WN);
+  ctr2_fill(t->choice_table, 1 << t->ghistoryBits, WT);
+}
+
+static void *
+tournament_init(const int *params)
+{
+  tournament_t *t = (tournament_t *)malloc(sizeof(tournament_t));
+  t->ghistoryBits = params[0];
+  t->lhistoryBits = params[1];
+  t->pcIndexBits = params[2];
+  size_t history_bytes = bitfield_bytes(1 << t->pcIndexBits, t->lhistoryBits);
+  size_t local_bytes = ctr2_bytes(1 << t->lhistoryBits);
+  size_t global_bytes = ctr2_bytes(1 << t->ghistoryBits);
+  if (!table_arena_init(&t->arena, table_bytes(history_bytes) + table_bytes(local_bytes) +
+                                   2 * table_bytes(global_bytes))) {
+    free(t);
+    return NULL;
+  }
+  t->local_history_table = (uint8_t *)table_arena_take(&t->arena, history_bytes);
+  t->local_bht = (uint8_t *)table_arena_take(&t->arena, local_bytes);
+  t->global_bht = (uint8_t *)table_arena_take(&t->arena, global_bytes);
+  t->choice_table = (uint8_t *)table_arena_take(&t->arena, global_bytes);
+  tournament_reset(t);
+  return t;
+}
+
+static uint8_t
+tournament_predict(void *state, uint32_t pc)
+{
+  tournament_t *t = (tournament_t *)state;
+  uint32_t global_index = t->ghr & ((1 << t->ghistoryBits) - 1);
+  uint32_t local_index = pc & ((1 << t->pcIndexBits) - 1);
+  uint32_t local_history = bitfield_get(t->local_history_table, local_index, t->lhistoryBits);
+  uint32_t local_bht_index = local_history & ((1 << t->lhistoryBits) - 1);
+
+  uint8_t local_pred = ctr2_predict(t->local_bht, local_bht_index);
+  uint8_t global_pred = ctr2_predict(t->global_bht, global_index);
+
+  return ctr2_predict(t->choice_table, global_index) ? global_pred : local_pred;
+}
+
+// Predict and train in one step, computing each index once
+static inline uint8_t
+tournament_step(void *state, uint32_t pc, uint8_t outcome)
+{
+  tournament_t *t = (tournament_t *)state;
+  uint32_t global_index = t->ghr & ((1 << t->ghistoryBits) - 1);
+  uint32_t local_index = pc & ((1 << t->pcIndexBits) - 1);
+  uint32_t local_history = bitfield_get(t->local_history_table, local_index, t->lhistoryBits);
+  uint32_t local_bht_index = local_history & ((1 << t->lhistoryBits) - 1);
+
+  uint8_t local_pred = ctr2_predict(t->local_bht, local_bht_index);
+  uint8_t global_pred = ctr2_predict(t->global_bht, global_index);
+  uint8_t prediction = ctr2_predict(t->choice_table, global_index) ? global_pred : local_pred;
+
+  ctr2_update(t->local_bht, local_bht_index, outcome);
+  ctr2_update(t->global_bht, global_index, outcome);
+  if (local_pred != global_pred) {
+    ctr2_update(t->choice_table, global_index, global_pred == outcome);
   }
-    default:
-      break;
+  bitfield_set(t->local_history_table, local_index, t->lhistoryBits,
+               ((local_history << 1) | outcome) & ((1 << t->lhistoryBits) - 1));
+  t->ghr = ((t->ghr << 1) | outcome) & ((1 << t->ghistoryBits) - 1);
+  return prediction;
+}
+
+static void
+tournament_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  tournament_step(state, pc, outcome);
+}
+
+PREDICTOR_RUN(tournament_run, tournament_step)
+
+static void
+tournament_destroy(void *state)
+{
+  tournament_t *t = (tournament_t *)state;
+  table_arena_release(&t->arena);
+  free(t);
+}
+
+// Local histories, local/global/choice 2-bit counters and the GHR
+static uint64_t
+tournament_bits(const int *params)
+{
+  int ghistoryBits = params[0], lhistoryBits = params[1], pcIndexBits = params[2];
+  return ((uint64_t)1 << pcIndexBits) * lhistoryBits +
+         2 * ((uint64_t)1 << lhistoryBits) +
+         4 * ((uint64_t)1 << ghistoryBits) +
+         ghistoryBits;
+}
+
+static size_t
+tournament_host_bytes(const void *state)
+{
+  const tournament_t *t = (const tournament_t *)state;
+  return sizeof(tournament_t) + t->arena.size;
+}
+
+static int
+tournament_checkpoint(void *state, FILE *f, int load)
+{
+  tournament_t *t = (tournament_t *)state;
+  return checkpoint_io(f, &t->ghr, sizeof(t->ghr), load) &&
+         checkpoint_io(f, t->local_history_table,
+                       bitfield_bytes(1 << t->pcIndexBits, t->lhistoryBits), load) &&
+         checkpoint_io(f, t->local_bht, ctr2_bytes(1 << t->lhistoryBits), load) &&
+         checkpoint_io(f, t->global_bht, ctr2_bytes(1 << t->ghistoryBits), load) &&
+         checkpoint_io(f, t->choice_table, ctr2_bytes(1 << t->ghistoryBits), load);
+}
+
+#ifdef SPECIALIZED_KERNELS
+// Fused predict+train loop for a fixed tournament geometry
+#define TOURNAMENT_KERNEL_LOOP(G, L, P, RECORD)                           \
+  for (uint64_t i = begin; i < end; i++) {                                \
+    uint8_t taken = (outcome[i >> 3] >> (i & 7)) & 1;                     \
+    uint32_t global_index = ghr & ((1u << G) - 1);                        \
+    uint32_t local_index = pc[i] & ((1u << P) - 1);                       \
+    uint32_t local_history = bitfield_get(local_history_table, local_index, L); \
+    uint32_t local_bht_index = local_history & ((1u << L) - 1);           \
+    uint8_t local_pred = ctr2_predict(local_bht, local_bht_index);        \
+    uint8_t global_pred = ctr2_predict(global_bht, global_index);         \
+    uint8_t choice = ctr2_predict(choice_table, global_index);            \
+    uint8_t prediction = choice ? global_pred : local_pred;               \
+    RECORD(pc[i]);                                                        \
+    mispredictions += prediction != taken;                                \
+    ctr2_update(local_bht, local_bht_index, taken);                       \
+    ctr2_update(global_bht, global_index, taken);                         \
+    if (local_pred != global_pred)                                        \
+      ctr2_update(choice_table, global_index, global_pred == taken);      \
+    bitfield_set(local_history_table, local_index, L,                     \
+                 ((local_history << 1) | taken) & ((1u << L) - 1));       \
+    ghr = ((ghr << 1) | taken) & ((1u << G) - 1);                         \
+  }
+
+#define TOURNAMENT_KERNEL(G, L, P)                                        \
+static uint32_t                                                           \
+tournament_kernel_##G##_##L##_##P(void *state, const uint32_t *pc,        \
+                     const uint8_t *outcome, uint64_t begin, uint64_t end, \
+                     uint32_t *missed)                                    \
+{                                                                         \
+  tournament_t *t = (tournament_t *)state;                                \
+  uint8_t *local_history_table = t->local_history_table;                  \
+  uint8_t *local_bht = t->local_bht;                                      \
+  uint8_t *global_bht = t->global_bht;                                    \
+  uint8_t *choice_table = t->choice_table;                                \
+  uint32_t ghr = t->ghr;                                                  \
+  uint32_t mispredictions = 0;                                            \
+  if (missed == NULL) {                                                   \
+    TOURNAMENT_KERNEL_LOOP(G, L, P, MISSED_SKIP)                          \
+  } else {                                                                \
+    TOURNAMENT_KERNEL_LOOP(G, L, P, MISSED_RECORD)                        \
+  }                                                                       \
+  t->ghr = ghr;                                                           \
+  return mispredictions;                                                  \
+}
+
+TOURNAMENT_KERNEL(9, 10, 10)
+#endif
+
+static predictor_kernel_t
+tournament_select_kernel(const int *params)
+{
+#ifdef SPECIALIZED_KERNELS
+  if (params[0] == 9 && params[1] == 10 && params[2] == 10) {
+    return tournament_kernel_9_10_10;
+  }
+#endif
+  return NULL;
+}
+
+//
+// Custom
+//
+
+static void
+custom_reset(void *state)
+{
+  custom_t *c = (custom_t *)state;
+  c->global_history = 0;
+  ctr2_fill(c->global_bht, GLOBAL_PHT_SIZE, WN);
+  ctr2_fill(c->choice_table, GLOBAL_PHT_SIZE, WT);
+  ctr2_fill(c->local_bht, LOCAL_PHT_SIZE, WN);
+  memset(c->local_history_table, 0, bitfield_bytes(LOCAL_HISTORY_TABLE_SIZE, LOCAL_HIST_BITS));
+}
+
+static void *
+custom_init(const int *params)
+{
+  custom_t *c = (custom_t *)malloc(sizeof(custom_t));
+  size_t history_bytes = bitfield_bytes(LOCAL_HISTORY_TABLE_SIZE, LOCAL_HIST_BITS);
+  if (!table_arena_init(&c->arena, 2 * table_bytes(ctr2_bytes(GLOBAL_PHT_SIZE)) +
+                                   table_bytes(ctr2_bytes(LOCAL_PHT_SIZE)) +
+                                   table_bytes(history_bytes))) {
+    free(c);
+    return NULL;
+  }
+  c->global_bht = (uint8_t *)table_arena_take(&c->arena, ctr2_bytes(GLOBAL_PHT_SIZE));
+  c->choice_table = (uint8_t *)table_arena_take(&c->arena, ctr2_bytes(GLOBAL_PHT_SIZE));
+  c->local_bht = (uint8_t *)table_arena_take(&c->arena, ctr2_bytes(LOCAL_PHT_SIZE));
+  c->local_history_table = (uint8_t *)table_arena_take(&c->arena, history_bytes);
+  custom_reset(c);
+  return c;
+}
+
+static uint8_t
+custom_predict(void *state, uint32_t pc)
+{
+  custom_t *c = (custom_t *)state;
+  uint32_t global_idx = c->global_history & (GLOBAL_PHT_SIZE - 1);
+  uint32_t local_idx = pc & (LOCAL_HISTORY_TABLE_SIZE - 1);
+  uint8_t local_hist = bitfield_get(c->local_history_table, local_idx, LOCAL_HIST_BITS);
+
+  uint8_t local_pred = ctr2_predict(c->local_bht, local_hist);
+  uint8_t global_pred = ctr2_predict(c->global_bht, global_idx);
+
+  return ctr2_predict(c->choice_table, global_idx) ? global_pred : local_pred;
+}
+
+// Predict and train in one step, computing each index once
+static inline uint8_t
+custom_step(void *state, uint32_t pc, uint8_t outcome)
+{
+  custom_t *c = (custom_t *)state;
+  uint32_t global_idx = c->global_history & (GLOBAL_PHT_SIZE - 1);
+  uint32_t local_idx = pc & (LOCAL_HISTORY_TABLE_SIZE - 1);
+  uint8_t local_hist = bitfield_get(c->local_history_table, local_idx, LOCAL_HIST_BITS);
+
+  uint8_t local_pred = ctr2_predict(c->local_bht, local_hist);
+  uint8_t global_pred = ctr2_predict(c->global_bht, global_idx);
+  uint8_t prediction = ctr2_predict(c->choice_table, global_idx) ? global_pred : local_pred;
+
+  ctr2_update(c->local_bht, local_hist, outcome);
+  ctr2_update(c->global_bht, global_idx, outcome);
+
+  if (local_pred != global_pred) {
+    ctr2_update(c->choice_table, global_idx, global_pred == outcome);
   }
+  bitfield_set(c->local_history_table, local_idx, LOCAL_HIST_BITS,
+               ((local_hist << 1) | outcome) & (LOCAL_PHT_SIZE - 1));
+  c->global_history = ((c->global_history << 1) | outcome) & (GLOBAL_PHT_SIZE - 1);
+  return prediction;
+}
 
+static void
+custom_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  custom_step(state, pc, outcome);
+}
+
+PREDICTOR_RUN(custom_run, custom_step)
+
+static void
+custom_destroy(void *state)
+{
+  custom_t *c = (custom_t *)state;
+  table_arena_release(&c->arena);
+  free(c);
+}
+
+// Global/choice/local 2-bit counters, 8-bit local histories and the GHR
+static uint64_t
+custom_bits(const int *params)
+{
+  return 2 * GLOBAL_PHT_SIZE + 2 * GLOBAL_PHT_SIZE + 2 * LOCAL_PHT_SIZE +
+         LOCAL_HIST_BITS * LOCAL_HISTORY_TABLE_SIZE + GLOBAL_HIST_BITS;
 }
 
+static size_t
+custom_host_bytes(const void *state)
+{
+  const custom_t *c = (const custom_t *)state;
+  return sizeof(custom_t) + c->arena.size;
+}
+
+static int
+custom_checkpoint(void *state, FILE *f, int load)
+{
+  custom_t *c = (custom_t *)state;
+  return checkpoint_io(f, &c->global_history, sizeof(c->global_history), load) &&
+         checkpoint_io(f, c->local_history_table,
+                       bitfield_bytes(LOCAL_HISTORY_TABLE_SIZE, LOCAL_HIST_BITS), load) &&
+         checkpoint_io(f, c->local_bht, ctr2_bytes(LOCAL_PHT_SIZE), load) &&
+         checkpoint_io(f, c->global_bht, ctr2_bytes(GLOBAL_PHT_SIZE), load) &&
+         checkpoint_io(f, c->choice_table, ctr2_bytes(GLOBAL_PHT_SIZE), load);
+}
+
+//
+// TAGE
+//
+
+// TAGE helper functions
+void tage_fold_init(folded_history_t *f, int orig_len, int comp_len) {
+  f->comp = 0;
+  f->orig_len = orig_len;
+  f->comp_len = comp_len;
+  f->outpoint = orig_len % comp_len;
+}
+
+// Shift the newest history bit in and the bit 'orig_len' back out
+void tage_fold_update(folded_history_t *f, const uint8_t *ghist, int ptr) {
+  f->comp = (f->comp << 1) ^ ghist[ptr & (TAGE_HIST_BUFFER - 1)];
+  f->comp ^= ghist[(ptr + f->orig_len) & (TAGE_HIST_BUFFER - 1)] << f->outpoint;
+  f->comp ^= f->comp >> f->comp_len;
+  f->comp &= (1 << f->comp_len) - 1;
+}
+
+uint32_t tage_index(tage_predictor_t *tage, uint32_t pc, int i) {
+  return pc ^ (pc >> tage->table_bits) ^ tage->index_fold[i].comp;
+}
+
+uint16_t tage_compute_tag(tage_predictor_t *tage, uint32_t pc, int i) {
+  uint32_t tag = pc ^ tage->tag_fold[0][i].comp ^ (tage->tag_fold[1][i].comp << 1);
+  return tag & ((1 << tage->tag_width) - 1);
+}
+
+static inline int
+tage_clamp(int value, int lo, int hi)
+{
+  return value < lo ? lo : value > hi ? hi : value;
+}
+
+// The parameters, in order, clamped to what the tables can represent
+static void
+tage_clamp_params(const int *params, int *clamped)
+{
+  clamped[0] = tage_clamp(params[0], 2, TAGE_MAX_COMPONENTS);
+  clamped[1] = tage_clamp(params[1], 1, TAGE_MAX_TABLE_BITS);
+  clamped[2] = tage_clamp(params[2], 2, TAGE_MAX_TAG_WIDTH);
+  clamped[4] = tage_clamp(params[4], 1, TAGE_HIST_BUFFER - 1);
+  clamped[3] = tage_clamp(params[3], 1, clamped[4]);
+  clamped[5] = tage_clamp(params[5], 1, TAGE_MAX_TABLE_BITS);
+  clamped[6] = tage_clamp(params[6], 0, TAGE_MAX_USE_ALT_BITS);
+  clamped[7] = params[7] > 0 ? tage_clamp(params[7], 1, TAGE_MAX_LOOP_BITS) : 0;
+  clamped[8] = params[8] > 0 ? tage_clamp(params[8], 1, TAGE_MAX_TABLE_BITS) : 0;
+}
+
+// History length of tagged component 'i' of 'num_components', a
+// geometric series from 'min_hist' to 'max_hist'
+static int
+tage_history_length(int i, int num_components, int min_hist, int max_hist)
+{
+  double ratio = (double)max_hist / min_hist;
+  double exponent = num_components > 2 ? (double)(i - 1) / (num_components - 2) : 0;
+  return (int)(min_hist * pow(ratio, exponent) + 0.5);
+}
+
+static void
+tage_reset(void *state)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)state;
+
+  ctr2_fill(tage->base_predictor, tage->table_sizes[0], WN);
+  uint32_t entries = tage->table_base[tage->num_components - 1] +
+                     tage->table_sizes[tage->num_components - 1];
+  memset(tage->tags, 0, sizeof(uint16_t) * entries);
+  memset(tage->ctrs, WN, entries);
+  memset(tage->useful, 0, entries);
+
+  tage->decay_tick = 0;
+  tage->decay_cursor = -1;
+  memset(tage->provider_hits, 0, sizeof(tage->provider_hits));
+  memset(tage->ghist, 0, TAGE_HIST_BUFFER);
+  tage->ghist_ptr = 0;
+  for (int i = 1; i < tage->num_components; i++) {
+    tage_fold_init(&tage->index_fold[i], tage->history_lengths[i], tage->table_bits);
+    tage_fold_init(&tage->tag_fold[0][i], tage->history_lengths[i], tage->tag_width);
+    tage_fold_init(&tage->tag_fold[1][i], tage->history_lengths[i], tage->tag_width - 1);
+  }
+
+  tage->use_alt_on_na = 0;
+  if (tage->loop_bits > 0) {
+    memset(tage->loop, 0, sizeof(tage_loop_t) << tage->loop_bits);
+  }
+  tage->with_loop = -1;
+  if (tage->sc_bits > 0) {
+    memset(tage->sc, 0, (size_t)TAGE_SC_TABLES << tage->sc_bits);
+  }
+  for (int j = 0; j < TAGE_SC_TABLES; j++) {
+    tage_fold_init(&tage->sc_fold[j], tage_sc_history[j], tage->sc_bits > 0 ? tage->sc_bits : 1);
+  }
+  tage->sc_threshold = TAGE_SC_THRESHOLD_INIT;
+  tage->sc_tc = 0;
+}
+
+static void *
+tage_init(const int *params)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)calloc(1, sizeof(tage_predictor_t));
+
+  // Parameters are clamped to what the tables can represent
+  int clamped[PREDICTOR_MAX_PARAMS];
+  tage_clamp_params(params, clamped);
+  tage->num_components = clamped[0];
+  tage->table_bits = clamped[1];
+  tage->tag_width = clamped[2];
+  int min_hist = clamped[3];
+  int max_hist = clamped[4];
+  int base_bits = clamped[5];
+  tage->use_alt_bits = clamped[6];
+  tage->loop_bits = clamped[7];
+  tage->sc_bits = clamped[8];
+
+  // Initialize history lengths as a geometric series
+  tage->history_lengths = (int*)malloc(sizeof(int) * tage->num_components);
+  tage->history_lengths[0] = 0;   // Base predictor
+  for (int i = 1; i < tage->num_components; i++) {
+    tage->history_lengths[i] = tage_history_length(i, tage->num_components, min_hist, max_hist);
+  }
+  tage->max_history = tage->history_lengths[tage->num_components - 1];
+  if (tage->sc_bits > 0 && tage_sc_history[TAGE_SC_TABLES - 1] > tage->max_history) {
+    tage->max_history = tage_sc_history[TAGE_SC_TABLES - 1];
+  }
+
+  // Initialize table sizes
+  tage->table_sizes = (int*)malloc(sizeof(int) * tage->num_components);
+  tage->table_sizes[0] = 1 << base_bits;
+  for (int i = 1; i < tage->num_components; i++) {
+    tage->table_sizes[i] = 1 << tage->table_bits;
+  }
+
+  // Lay the tagged tables out back to back and carve the base
+  // predictor, the tag, counter and useful arrays, the history
+  // buffer and the optional components out of one arena
+  uint32_t entries = 0;
+  for (int i = 1; i < tage->num_components; i++) {
+    tage->table_base[i] = entries;
+    entries += tage->table_sizes[i];
+  }
+  size_t base_bytes = ctr2_bytes(tage->table_sizes[0]);
+  size_t loop_bytes = tage->loop_bits > 0 ? sizeof(tage_loop_t) << tage->loop_bits : 0;
+  size_t sc_bytes = tage->sc_bits > 0 ? (size_t)TAGE_SC_TABLES << tage->sc_bits : 0;
+  if (!table_arena_init(&tage->arena, table_bytes(base_bytes) +
+                                      table_bytes(sizeof(uint16_t) * entries) +
+                                      2 * table_bytes(entries) + table_bytes(TAGE_HIST_BUFFER) +
+                                      table_bytes(loop_bytes) + table_bytes(sc_bytes))) {
+    free(tage->table_sizes);
+    free(tage->history_lengths);
+    free(tage);
+    return NULL;
+  }
+  tage->base_predictor = (uint8_t *)table_arena_take(&tage->arena, base_bytes);
+  tage->tags = (uint16_t *)table_arena_take(&tage->arena, sizeof(uint16_t) * entries);
+  tage->ctrs = (uint8_t *)table_arena_take(&tage->arena, entries);
+  tage->useful = (uint8_t *)table_arena_take(&tage->arena, entries);
+  tage->ghist = (uint8_t *)table_arena_take(&tage->arena, TAGE_HIST_BUFFER);
+  tage->loop = (tage_loop_t *)table_arena_take(&tage->arena, loop_bytes);
+  tage->sc = (int8_t *)table_arena_take(&tage->arena, sc_bytes);
+
+  // Allocate folded history state
+  tage->index_fold = (folded_history_t*)malloc(sizeof(folded_history_t) * tage->num_components);
+  tage->tag_fold[0] = (folded_history_t*)malloc(sizeof(folded_history_t) * tage->num_components);
+  tage->tag_fold[1] = (folded_history_t*)malloc(sizeof(folded_history_t) * tage->num_components);
+
+  tage_reset(tage);
+  return tage;
+}
+
+// Saturating step of a signed counter of 'bits' bits
+static inline int
+tage_signed_update(int counter, int up, int bits)
+{
+  int max = (1 << (bits - 1)) - 1;
+  return up ? counter + (counter < max) : counter - (counter > -max - 1);
+}
+
+// Look up the loop predictor entry of 'pc'
+static inline void
+tage_loop_lookup(tage_predictor_t *tage, uint32_t pc)
+{
+  tage->loop_slot = pc & ((1u << tage->loop_bits) - 1);
+  tage->loop_tag = (pc >> tage->loop_bits) & ((1u << TAGE_LOOP_TAG_BITS) - 1);
+  const tage_loop_t *e = &tage->loop[tage->loop_slot];
+  tage->loop_hit = e->tag == tage->loop_tag;
+  tage->loop_valid = tage->loop_hit && e->conf == TAGE_LOOP_CONF_MAX;
+  tage->loop_pred = e->iter + 1 == e->trip ? !e->dir : e->dir;
+}
+
+// Count the iteration of a tracked loop, learning its trip count on
+// each exit; an untracked branch TAGE mispredicted takes over an
+// entry once that entry has aged out
+static void
+tage_loop_train(tage_predictor_t *tage, uint8_t outcome)
+{
+  tage_loop_t *e = &tage->loop[tage->loop_slot];
+  if (!tage->loop_hit) {
+    if (tage->prediction != outcome) {
+      if (e->age == 0) {
+        // Take this outcome to be a loop exit
+        e->tag = tage->loop_tag;
+        e->dir = !outcome;
+        e->iter = 0;
+        e->trip = 0;
+        e->conf = 0;
+        e->age = TAGE_LOOP_AGE_MAX;
+      } else {
+        e->age--;
+      }
+    }
+    return;
+  }
+
+  if (tage->loop_valid) {
+    if (tage->loop_pred != tage->tage_pred) {
+      tage->with_loop = tage_signed_update(tage->with_loop, tage->loop_pred == outcome,
+                                           TAGE_WITH_LOOP_BITS);
+      if (tage->loop_pred == outcome && e->age < TAGE_LOOP_AGE_MAX) {
+        e->age++;
+      }
+    }
+    if (tage->loop_pred != outcome) {
+      // The trip count changed; free the entry
+      e->iter = 0;
+      e->trip = 0;
+      e->conf = 0;
+      e->age = 0;
+      return;
+    }
+  }
+
+  e->iter = (e->iter + 1) & ((1u << TAGE_LOOP_ITER_BITS) - 1);
+  if (e->trip != 0 && e->iter > e->trip) {
+    // Ran past the trip count, learn it again
+    e->trip = 0;
+    e->conf = 0;
+  }
+  if (outcome != e->dir) {
+    if (e->iter == e->trip) {
+      if (e->conf < TAGE_LOOP_CONF_MAX) {
+        e->conf++;
+      }
+      if (e->trip < TAGE_LOOP_MIN_TRIP) {
+        e->trip = 0;
+        e->conf = 0;
+        e->age = 0;
+      }
+    } else if (e->trip == 0) {
+      e->trip = e->iter;
+    } else {
+      e->trip = 0;
+      e->conf = 0;
+    }
+    e->iter = 0;
+  }
+}
+
+// Provider counter saturated
+static inline uint8_t
+tage_confident(const tage_predictor_t *tage)
+{
+  if (tage->provider_component == 0) {
+    uint8_t ctr = ctr2_get(tage->base_predictor, tage->slots[0]);
+    return ctr == SN || ctr == ST;
+  }
+  uint8_t ctr = tage->ctrs[tage->slots[tage->provider_component]];
+  return ctr == 0 || ctr == 7;
+}
+
+// Statistical corrector: sum the bias table, indexed by the PC and
+// the prediction 'input', and the GEHL tables, indexed by the PC and
+// the folded global history. A sum that disagrees with 'input' by at
+// least the threshold overrides it.
+static inline uint8_t
+tage_sc_predict(tage_predictor_t *tage, uint32_t pc, uint8_t input)
+{
+  uint32_t mask = (1u << tage->sc_bits) - 1;
+  uint32_t hash = pc ^ (pc >> tage->sc_bits);
+  tage->sc_input = input;
+  tage->sc_slots[0] = ((hash << 3) | (tage_confident(tage) << 2) |
+                       (tage->provider_pred << 1) | input) & mask;
+  for (int j = 1; j < TAGE_SC_TABLES; j++) {
+    tage->sc_slots[j] = ((uint32_t)j << tage->sc_bits) + ((hash ^ tage->sc_fold[j].comp) & mask);
+  }
+  int sum = 0;
+  for (int j = 0; j < TAGE_SC_TABLES; j++) {
+    sum += 2 * tage->sc[tage->sc_slots[j]] + 1;
+  }
+  tage->sc_sum = sum;
+  uint8_t sc_pred = sum >= 0 ? TAKEN : NOTTAKEN;
+  int magnitude = sum < 0 ? -sum : sum;
+  return sc_pred != input && magnitude >= tage->sc_threshold ? sc_pred : input;
+}
+
+// Train the corrector tables when the sum was wrong or weak, and adapt
+// the threshold on the branches where the corrector disagreed
+static void
+tage_sc_train(tage_predictor_t *tage, uint8_t outcome)
+{
+  uint8_t sc_pred = tage->sc_sum >= 0 ? TAKEN : NOTTAKEN;
+  int magnitude = tage->sc_sum < 0 ? -tage->sc_sum : tage->sc_sum;
+  if (sc_pred != tage->sc_input) {
+    if (sc_pred != outcome) {
+      tage->sc_tc = tage_signed_update(tage->sc_tc, 1, TAGE_SC_TC_BITS);
+      if (tage->sc_tc == (1 << (TAGE_SC_TC_BITS - 1)) - 1) {
+        tage->sc_threshold++;
+        tage->sc_tc = 0;
+      }
+    } else if (magnitude < tage->sc_threshold) {
+      tage->sc_tc = tage_signed_update(tage->sc_tc, 0, TAGE_SC_TC_BITS);
+      if (tage->sc_tc == -(1 << (TAGE_SC_TC_BITS - 1)) && tage->sc_threshold > 1) {
+        tage->sc_threshold--;
+        tage->sc_tc = 0;
+      }
+    }
+  }
+  if (sc_pred != outcome || magnitude < tage->sc_threshold) {
+    for (int j = 0; j < TAGE_SC_TABLES; j++) {
+      int8_t *ctr = &tage->sc[tage->sc_slots[j]];
+      *ctr = tage_signed_update(*ctr, outcome == TAKEN, TAGE_SC_CTR_BITS);
+    }
+  }
+}
+
+static uint8_t
+tage_predict(void *state, uint32_t pc)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)state;
+
+  // Compute the arena slot and tag of every component
+  tage->slots[0] = pc & (tage->table_sizes[0] - 1);
+  for (int i = 1; i < tage->num_components; i++) {
+    tage->slots[i] = tage->table_base[i] +
+                     (tage_index(tage, pc, i) & (tage->table_sizes[i] - 1));
+    tage->table_tags[i] = tage_compute_tag(tage, pc, i);
+  }
+
+  // Match all components at once into a bitmask (the base always
+  // hits); the loop has no early exit so it vectorizes
+  uint32_t hits = 1;
+  for (int i = 1; i < tage->num_components; i++) {
+    hits |= (uint32_t)(tage->tags[tage->slots[i]] == tage->table_tags[i]) << i;
+  }
+
+  // The provider is the longest match, the alternate the next one
+  tage->provider_component = 31 - __builtin_clz(hits);
+  hits &= (1u << tage->provider_component) - 1;
+  tage->altpred_component = hits ? 31 - __builtin_clz(hits) : 0;
+
+  // Get predictions
+  if (tage->provider_component == 0) {
+    tage->provider_pred = ctr2_predict(tage->base_predictor, tage->slots[0]);
+  } else {
+    tage->provider_pred = tage->ctrs[tage->slots[tage->provider_component]] >= 4 ? TAKEN : NOTTAKEN;
+  }
+
+  if (tage->altpred_component == 0) {
+    tage->altpred = ctr2_predict(tage->base_predictor, tage->slots[0]);
+  } else {
+    tage->altpred = tage->ctrs[tage->slots[tage->altpred_component]] >= 4 ? TAKEN : NOTTAKEN;
+  }
+
+  // Use provider prediction, or the alternate while the provider
+  // entry is newly allocated and alternates have been doing better
+  tage->provider_hits[tage->provider_component]++;
+  uint8_t prediction = tage->provider_pred;
+  if (tage->use_alt_bits > 0) {
+    uint32_t slot = tage->slots[tage->provider_component];
+    tage->provider_new = tage->provider_component > 0 &&
+                         (tage->ctrs[slot] == 3 || tage->ctrs[slot] == 4) &&
+                         tage->useful[slot] == 0;
+    if (tage->provider_new && tage->use_alt_on_na >= 0) {
+      prediction = tage->altpred;
+    }
+  }
+  tage->tage_pred = prediction;
+
+  if (tage->loop_bits > 0) {
+    tage_loop_lookup(tage, pc);
+    if (tage->loop_valid && tage->with_loop >= 0) {
+      prediction = tage->loop_pred;
+    }
+  }
+  if (tage->sc_bits > 0) {
+    prediction = tage_sc_predict(tage, pc, prediction);
+  }
+  tage->prediction = prediction;
+  return prediction;
+}
+
+static void
+tage_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)state;
+
+  // Optional components learn from the predictions made before this
+  // update changes the provider entry
+  if (tage->use_alt_bits > 0 && tage->provider_new && tage->provider_pred != tage->altpred) {
+    tage->use_alt_on_na = tage_signed_update(tage->use_alt_on_na, tage->altpred == outcome,
+                                             tage->use_alt_bits);
+  }
+  if (tage->loop_bits > 0) {
+    tage_loop_train(tage, outcome);
+  }
+  if (tage->sc_bits > 0) {
+    tage_sc_train(tage, outcome);
+  }
+
+  // Update provider component
+  if (tage->provider_component == 0) {
+    // Update base predictor
+    ctr2_update(tage->base_predictor, tage->slots[0], outcome);
+  } else {
+    // Update tagged table entry
+    uint32_t slot = tage->slots[tage->provider_component];
+    uint8_t *ctr = &tage->ctrs[slot];
+    uint8_t *useful = &tage->useful[slot];
+    if (outcome == TAKEN) {
+      if (*ctr < 7) (*ctr)++;
+    } else {
+      if (*ctr > 0) (*ctr)--;
+    }
+
+    // Update useful counter
+    if (tage->provider_pred != tage->altpred) {
+      if (tage->provider_pred == outcome && *useful < 3) {
+        (*useful)++;
+      } else if (tage->provider_pred != outcome && *useful > 0) {
+        (*useful)--;
+      }
+    }
+  }
+
+  // Allocate new entries on misprediction
+  if (tage->provider_pred != outcome) {
+    // Find a table to allocate in
+    for (int i = tage->provider_component + 1; i < tage->num_components; i++) {
+      uint32_t slot = tage->slots[i];
+
+      // Check if entry is available (useful == 0)
+      if (tage->useful[slot] == 0) {
+        tage->tags[slot] = tage->table_tags[i];
+        tage->ctrs[slot] = (outcome == TAKEN) ? 4 : 3;
+        break;
+      }
+    }
+
+    // Start an aging pass every TAGE_DECAY_PERIOD mispredictions
+    if (++tage->decay_tick >= TAGE_DECAY_PERIOD && tage->decay_cursor < 0) {
+      tage->decay_tick = 0;
+      tage->decay_cursor = 0;
+    }
+  }
+
+  // Age a bounded slice of every tagged table per branch so a pass
+  // never stalls a single prediction
+  if (tage->decay_cursor >= 0) {
+    int end = tage->decay_cursor + TAGE_DECAY_STRIDE;
+    for (int i = 1; i < tage->num_components; i++) {
+      int limit = end < tage->table_sizes[i] ? end : tage->table_sizes[i];
+      uint8_t *useful = tage->useful + tage->table_base[i];
+      for (int j = tage->decay_cursor; j < limit; j++) {
+        useful[j] -= useful[j] > 0;
+      }
+    }
+    tage->decay_cursor = end < (1 << tage->table_bits) ? end : -1;
+  }
+
+  // Update global history and the folded registers
+  tage->ghist_ptr = (tage->ghist_ptr - 1) & (TAGE_HIST_BUFFER - 1);
+  tage->ghist[tage->ghist_ptr] = outcome;
+  for (int i = 1; i < tage->num_components; i++) {
+    tage_fold_update(&tage->index_fold[i], tage->ghist, tage->ghist_ptr);
+    tage_fold_update(&tage->tag_fold[0][i], tage->ghist, tage->ghist_ptr);
+    tage_fold_update(&tage->tag_fold[1][i], tage->ghist, tage->ghist_ptr);
+  }
+  if (tage->sc_bits > 0) {
+    for (int j = 1; j < TAGE_SC_TABLES; j++) {
+      tage_fold_update(&tage->sc_fold[j], tage->ghist, tage->ghist_ptr);
+    }
+  }
+}
+
+// TAGE keeps the indices and tags from predict() for train(), so
+// the fused step is simply the two in sequence
+static inline uint8_t
+tage_step(void *state, uint32_t pc, uint8_t outcome)
+{
+  uint8_t prediction = tage_predict(state, pc);
+  tage_train(state, pc, outcome);
+  return prediction;
+}
+
+PREDICTOR_RUN(tage_run, tage_step)
+
+// Index folds and history position of the branch being looked ahead at
+typedef struct {
+  int ptr;
+  folded_history_t fold[TAGE_MAX_COMPONENTS];
+} tage_ahead_t;
+
+// The ahead copy writes outcomes into the circular history before
+// train() does (the same values). They must stay clear of the oldest
+// bits train() still folds out, so the distance is bounded by the
+// part of the buffer beyond the longest history.
+static inline int
+tage_ahead_start(void *state, tage_ahead_t *ahead, int distance)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)state;
+  int limit = TAGE_HIST_BUFFER - 1 - tage->max_history;
+  ahead->ptr = tage->ghist_ptr;
+  memcpy(ahead->fold, tage->index_fold, sizeof(folded_history_t) * tage->num_components);
+  return distance < limit ? distance : limit;
+}
+
+static inline void
+tage_ahead(void *state, tage_ahead_t *ahead, uint32_t pc, uint8_t outcome)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)state;
+  __builtin_prefetch(&tage->base_predictor[(pc & (tage->table_sizes[0] - 1)) >> 2], 1);
+  for (int i = 1; i < tage->num_components; i++) {
+    uint32_t slot = tage->table_base[i] +
+                    ((pc ^ (pc >> tage->table_bits) ^ ahead->fold[i].comp) &
+                     (tage->table_sizes[i] - 1));
+    __builtin_prefetch(&tage->tags[slot], 1);
+    __builtin_prefetch(&tage->ctrs[slot], 1);
+  }
+  ahead->ptr = (ahead->ptr - 1) & (TAGE_HIST_BUFFER - 1);
+  tage->ghist[ahead->ptr] = outcome;
+  for (int i = 1; i < tage->num_components; i++) {
+    tage_fold_update(&ahead->fold[i], tage->ghist, ahead->ptr);
+  }
+}
+
+PREDICTOR_RUN_AHEAD(tage_run_ahead, tage_step, tage_ahead_t,
+                    tage_ahead_start, tage_ahead)
+
+static void
+tage_destroy(void *state)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)state;
+  table_arena_release(&tage->arena);
+  free(tage->history_lengths);
+  free(tage->table_sizes);
+  free(tage->index_fold);
+  free(tage->tag_fold[0]);
+  free(tage->tag_fold[1]);
+  free(tage);
+}
+
+// Tables, history, folded registers and aging progress; indices and
+// tags are recomputed by the next predict()
+static int
+tage_checkpoint(void *state, FILE *f, int load)
+{
+  tage_predictor_t *tage = (tage_predictor_t *)state;
+  uint32_t entries = tage->table_base[tage->num_components - 1] +
+                     tage->table_sizes[tage->num_components - 1];
+  int ok = checkpoint_io(f, tage->base_predictor, ctr2_bytes(tage->table_sizes[0]), load) &&
+           checkpoint_io(f, tage->tags, sizeof(uint16_t) * entries, load) &&
+           checkpoint_io(f, tage->ctrs, entries, load) &&
+           checkpoint_io(f, tage->useful, entries, load);
+  size_t folds = sizeof(folded_history_t) * tage->num_components;
+  return ok &&
+         checkpoint_io(f, &tage->decay_tick, sizeof(tage->decay_tick), load) &&
+         checkpoint_io(f, &tage->decay_cursor, sizeof(tage->decay_cursor), load) &&
+         checkpoint_io(f, tage->ghist, TAGE_HIST_BUFFER, load) &&
+         checkpoint_io(f, &tage->ghist_ptr, sizeof(tage->ghist_ptr), load) &&
+         checkpoint_io(f, tage->index_fold, folds, load) &&
+         checkpoint_io(f, tage->tag_fold[0], folds, load) &&
+         checkpoint_io(f, tage->tag_fold[1], folds, load) &&
+         checkpoint_io(f, tage->provider_hits, sizeof(tage->provider_hits), load) &&
+         checkpoint_io(f, &tage->use_alt_on_na, sizeof(tage->use_alt_on_na), load) &&
+         (tage->loop_bits == 0 ||
+          (checkpoint_io(f, tage->loop, sizeof(tage_loop_t) << tage->loop_bits, load) &&
+           checkpoint_io(f, &tage->with_loop, sizeof(tage->with_loop), load))) &&
+         (tage->sc_bits == 0 ||
+          (checkpoint_io(f, tage->sc, (size_t)TAGE_SC_TABLES << tage->sc_bits, load) &&
+           checkpoint_io(f, tage->sc_fold, sizeof(tage->sc_fold), load) &&
+           checkpoint_io(f, &tage->sc_threshold, sizeof(tage->sc_threshold), load) &&
+           checkpoint_io(f, &tage->sc_tc, sizeof(tage->sc_tc), load)));
+}
+
+static int
+tage_components(const void *state, uint64_t *counts)
+{
+  const tage_predictor_t *tage = (const tage_predictor_t *)state;
+  memcpy(counts, tage->provider_hits, sizeof(tage->provider_hits));
+  return tage->num_components;
+}
+
+// Bimodal base, tagged entries (counter + tag + useful), the longest
+// global history and the optional components
+static uint64_t
+tage_bits(const int *params)
+{
+  int clamped[PREDICTOR_MAX_PARAMS];
+  tage_clamp_params(params, clamped);
+  int num_components = clamped[0];
+  int loop_bits = clamped[7];
+  int sc_bits = clamped[8];
+  int max_history = tage_history_length(num_components - 1, num_components, clamped[3], clamped[4]);
+  if (sc_bits > 0 && tage_sc_history[TAGE_SC_TABLES - 1] > max_history) {
+    max_history = tage_sc_history[TAGE_SC_TABLES - 1];
+  }
+
+  uint64_t bits = 2 * ((uint64_t)1 << clamped[5]) + max_history;
+  bits += (uint64_t)(num_components - 1) * ((uint64_t)1 << clamped[1]) *
+          (3 + clamped[2] + TAGE_USEFUL_BITS);
+  bits += clamped[6];
+  if (loop_bits > 0) {
+    // Tag, iteration and trip counts, 2-bit confidence, age and direction
+    bits += ((uint64_t)1 << loop_bits) * (TAGE_LOOP_TAG_BITS + 2 * TAGE_LOOP_ITER_BITS + 2 + 8 + 1) +
+            TAGE_WITH_LOOP_BITS;
+  }
+  if (sc_bits > 0) {
+    bits += ((uint64_t)TAGE_SC_TABLES << sc_bits) * TAGE_SC_CTR_BITS + 16 + TAGE_SC_TC_BITS;
+  }
+  return bits;
+}
+
+// Tags are held in 16 bits and counters in whole bytes, and the
+// simulator keeps the full circular history rather than the longest
+static size_t
+tage_host_bytes(const void *state)
+{
+  const tage_predictor_t *tage = (const tage_predictor_t *)state;
+  return sizeof(tage_predictor_t) + tage->arena.size +
+         2 * sizeof(int) * tage->num_components +
+         3 * sizeof(folded_history_t) * tage->num_components;
+}
+
+//
+// Perceptron
+//
+
+// One predict+train step on weight vector 'w': returns the prediction
+// for 'outcome', trains 'w' if it was wrong or not confident, then
+// shifts 'outcome' into the history vector. The SIMD versions below
+// produce exactly the same state as this one.
+static uint8_t
+perceptron_step_scalar(perceptron_t *p, int8_t *w, uint8_t outcome)
+{
+  int8_t *x = p->history;
+  int32_t y = 0;
+  for (int i = 0; i < p->width; i++) {
+    y += w[i] * x[i];
+  }
+  uint8_t prediction = y >= 0 ? TAKEN : NOTTAKEN;
+
+  int8_t t = outcome == TAKEN ? 1 : -1;
+  if (prediction != outcome || abs(y) <= p->theta) {
+    for (int i = 0; i < p->width; i++) {
+      int v = w[i] + t * x[i];
+      w[i] = v > PERCEPTRON_WEIGHT_MAX ? PERCEPTRON_WEIGHT_MAX :
+             v < -PERCEPTRON_WEIGHT_MAX ? -PERCEPTRON_WEIGHT_MAX : v;
+    }
+  }
+  for (int i = p->historyBits; i > 1; i--) {
+    x[i] = x[i - 1];
+  }
+  x[1] = t;
+  return prediction;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PERCEPTRON_SIMD
+
+// x is +-1 or 0, so sign(w, x) is w*x and sign(x, t) is t*x. Products
+// are summed pairwise into int16 (maddubs against ones), then into
+// int32. The history shifts up one lane by reloading each register a
+// byte lower (from the top register down, so nothing is overwritten
+// before it is read), masking off the lanes past the history and
+// inserting the bias and newest outcome.
+__attribute__((target("ssse3")))
+static uint8_t
+perceptron_step_ssse3(perceptron_t *p, int8_t *w, uint8_t outcome)
+{
+  int8_t *x = p->history;
+  __m128i ones8 = _mm_set1_epi8(1);
+  __m128i ones16 = _mm_set1_epi16(1);
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < p->width; i += 16) {
+    __m128i v = _mm_sign_epi8(_mm_loadu_si128((const __m128i *)(w + i)),
+                              _mm_loadu_si128((const __m128i *)(x + i)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(ones8, v), ones16));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t y = _mm_cvtsi128_si32(sum);
+  uint8_t prediction = y >= 0 ? TAKEN : NOTTAKEN;
+
+  int8_t t = outcome == TAKEN ? 1 : -1;
+  if (prediction != outcome || abs(y) <= p->theta) {
+    __m128i tv = _mm_set1_epi8(t);
+    __m128i min = _mm_set1_epi8(-128);
+    for (int i = 0; i < p->width; i += 16) {
+      __m128i wv = _mm_loadu_si128((const __m128i *)(w + i));
+      wv = _mm_adds_epi8(wv, _mm_sign_epi8(_mm_loadu_si128((const __m128i *)(x + i)), tv));
+      // No signed byte max before SSE4.1; lift -128 back to -127
+      wv = _mm_sub_epi8(wv, _mm_cmpeq_epi8(wv, min));
+      _mm_storeu_si128((__m128i *)(w + i), wv);
+    }
+  }
+  for (int i = p->width - 16; i >= 0; i -= 16) {
+    __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(x + i - 1)),
+                              _mm_loadu_si128((const __m128i *)(p->shift_mask + i)));
+    _mm_storeu_si128((__m128i *)(x + i), v);
+  }
+  x[0] = 1;
+  x[1] = t;
+  return prediction;
+}
+
+__attribute__((target("avx2")))
+static uint8_t
+perceptron_step_avx2(perceptron_t *p, int8_t *w, uint8_t outcome)
+{
+  int8_t *x = p->history;
+  __m256i ones8 = _mm256_set1_epi8(1);
+  __m256i ones16 = _mm256_set1_epi16(1);
+  __m256i sum = _mm256_setzero_si256();
+  for (int i = 0; i < p->width; i += 32) {
+    __m256i v = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *)(w + i)),
+                                 _mm256_loadu_si256((const __m256i *)(x + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(ones8, v), ones16));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t y = _mm_cvtsi128_si32(s);
+  uint8_t prediction = y >= 0 ? TAKEN : NOTTAKEN;
+
+  int8_t t = outcome == TAKEN ? 1 : -1;
+  if (prediction != outcome || abs(y) <= p->theta) {
+    __m256i tv = _mm256_set1_epi8(t);
+    __m256i lo = _mm256_set1_epi8(-PERCEPTRON_WEIGHT_MAX);
+    for (int i = 0; i < p->width; i += 32) {
+      __m256i wv = _mm256_loadu_si256((const __m256i *)(w + i));
+      wv = _mm256_adds_epi8(wv, _mm256_sign_epi8(_mm256_loadu_si256((const __m256i *)(x + i)), tv));
+      _mm256_storeu_si256((__m256i *)(w + i), _mm256_max_epi8(wv, lo));
+    }
+  }
+  for (int i = p->width - 32; i >= 0; i -= 32) {
+    __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(x + i - 1)),
+                                 _mm256_loadu_si256((const __m256i *)(p->shift_mask + i)));
+    _mm256_storeu_si256((__m256i *)(x + i), v);
+  }
+  x[0] = 1;
+  x[1] = t;
+  return prediction;
+}
+#endif
+
+static void
+perceptron_reset(void *state)
+{
+  perceptron_t *p = (perceptron_t *)state;
+  memset(p->weights, 0, (size_t)p->rows * p->width);
+  memset(p->history - 1, 0, p->width + 1);
+  p->history[0] = 1;
+  memset(p->history + 1, -1, p->historyBits);
+}
+
+static void *
+perceptron_init(const int *params)
+{
+  perceptron_t *p = (perceptron_t *)malloc(sizeof(perceptron_t));
+  p->historyBits = params[0] < 1 ? 1 :
+                   params[0] > PERCEPTRON_MAX_HIST ? PERCEPTRON_MAX_HIST : params[0];
+  p->rows = params[1] < 1 ? 1 : params[1];
+  p->row_mask = (p->rows & (p->rows - 1)) == 0 ? p->rows - 1 : 0;
+  p->width = (p->historyBits + 1 + PERCEPTRON_LANES - 1) / PERCEPTRON_LANES * PERCEPTRON_LANES;
+  p->theta = (int)(1.93 * p->historyBits + 14);
+  size_t weight_bytes = (size_t)p->rows * p->width;
+  if (!table_arena_init(&p->arena, table_bytes(weight_bytes) + table_bytes(p->width + 1) +
+                                   table_bytes(p->width))) {
+    free(p);
+    return NULL;
+  }
+  p->weights = (int8_t *)table_arena_take(&p->arena, weight_bytes);
+
+  // One spare byte below the history for the shifting loads; the mask
+  // keeps lanes 2..historyBits of a shifted history
+  p->history_base = (int8_t *)table_arena_take(&p->arena, p->width + 1);
+  p->history = p->history_base + 1;
+  p->shift_mask = (int8_t *)table_arena_take(&p->arena, p->width);
+  memset(p->shift_mask, 0, p->width);
+  memset(p->shift_mask + 2, -1, p->historyBits - 1 > 0 ? p->historyBits - 1 : 0);
+
+  p->step = perceptron_step_scalar;
+#ifdef PERCEPTRON_SIMD
+  if (getenv("PERCEPTRON_SCALAR") != NULL) {
+    // Keep the scalar step, to check the SIMD ones against it
+  } else if (__builtin_cpu_supports("avx2")) {
+    p->step = perceptron_step_avx2;
+  } else if (__builtin_cpu_supports("ssse3")) {
+    p->step = perceptron_step_ssse3;
+  }
+#endif
+
+  perceptron_reset(p);
+  return p;
+}
+
+static inline int8_t *
+perceptron_row(perceptron_t *p, uint32_t pc)
+{
+  uint32_t row = p->row_mask ? pc & p->row_mask : pc % p->rows;
+  return p->weights + (size_t)row * p->width;
+}
+
+static uint8_t
+perceptron_predict(void *state, uint32_t pc)
+{
+  perceptron_t *p = (perceptron_t *)state;
+  const int8_t *w = perceptron_row(p, pc);
+  int32_t y = 0;
+  for (int i = 0; i < p->width; i++) {
+    y += w[i] * p->history[i];
+  }
+  return y >= 0 ? TAKEN : NOTTAKEN;
+}
+
+static inline uint8_t
+perceptron_step(void *state, uint32_t pc, uint8_t outcome)
+{
+  perceptron_t *p = (perceptron_t *)state;
+  return p->step(p, perceptron_row(p, pc), outcome);
+}
+
+static void
+perceptron_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  perceptron_step(state, pc, outcome);
+}
+
+PREDICTOR_RUN(perceptron_run, perceptron_step)
+
+static void
+perceptron_destroy(void *state)
+{
+  perceptron_t *p = (perceptron_t *)state;
+  table_arena_release(&p->arena);
+  free(p);
+}
+
+// 8-bit weights (bias + one per history bit) per row and the history
+static uint64_t
+perceptron_bits(const int *params)
+{
+  int historyBits = params[0] < 1 ? 1 :
+                    params[0] > PERCEPTRON_MAX_HIST ? PERCEPTRON_MAX_HIST : params[0];
+  int rows = params[1] < 1 ? 1 : params[1];
+  return 8 * (uint64_t)rows * (historyBits + 1) + historyBits;
+}
+
+// Weight vectors and history padded to whole vector registers
+static size_t
+perceptron_host_bytes(const void *state)
+{
+  const perceptron_t *p = (const perceptron_t *)state;
+  return sizeof(perceptron_t) + p->arena.size;
+}
+
+static int
+perceptron_checkpoint(void *state, FILE *f, int load)
+{
+  perceptron_t *p = (perceptron_t *)state;
+  return checkpoint_io(f, p->weights, (size_t)p->rows * p->width, load) &&
+         checkpoint_io(f, p->history, p->width, load);
+}
+
+//------------------------------------//
+//        Predictor Registry          //
+//------------------------------------//
+
+// Parameter limits, which bound the tables a configuration allocates
+#define INDEX_BITS_MAX 26           // Gshare, bimodal and tournament counter tables
+#define LOCAL_INDEX_BITS_MAX 20     // Tournament local history table
+
+static const predictor_ops_t static_ops = {
+  .name = "static", .usage = "static",
+  .init = static_init, .predict = static_predict, .train = static_train,
+  .destroy = static_destroy, .bits = static_bits,
+  .host_bytes = static_host_bytes,
+  .reset = static_reset, .run = static_run,
+  .checkpoint = static_checkpoint,
+};
+
+static const predictor_ops_t gshare_ops = {
+  .name = "gshare", .usage = "gshare:<# ghistory>",
+  .num_params = 1, .required_params = 1,
+  .min = { 0 }, .max = { INDEX_BITS_MAX },
+  .init = gshare_init, .predict = gshare_predict, .train = gshare_train,
+  .destroy = gshare_destroy, .bits = gshare_bits,
+  .host_bytes = gshare_host_bytes,
+  .reset = gshare_reset, .run = gshare_run,
+  .checkpoint = gshare_checkpoint,
+  .select_kernel = gshare_select_kernel,
+  .run_ahead = gshare_run_ahead,
+};
+
+static const predictor_ops_t tournament_ops = {
+  .name = "tournament", .usage = "tournament:<# ghistory>:<# lhistory>:<# index>",
+  .num_params = 3, .required_params = 3,
+  .min = { 0, 0, 0 }, .max = { INDEX_BITS_MAX, INDEX_BITS_MAX, LOCAL_INDEX_BITS_MAX },
+  .init = tournament_init, .predict = tournament_predict, .train = tournament_train,
+  .destroy = tournament_destroy, .bits = tournament_bits,
+  .host_bytes = tournament_host_bytes,
+  .reset = tournament_reset, .run = tournament_run,
+  .checkpoint = tournament_checkpoint,
+  .select_kernel = tournament_select_kernel,
+};
+
+static const predictor_ops_t custom_ops = {
+  .name = "custom", .usage = "custom",
+  .init = custom_init, .predict = custom_predict, .train = custom_train,
+  .destroy = custom_destroy, .bits = custom_bits,
+  .host_bytes = custom_host_bytes,
+  .reset = custom_reset, .run = custom_run,
+  .checkpoint = custom_checkpoint,
+};
+
+static const predictor_ops_t tage_ops = {
+  .name = "tage",
+  .usage = "tage:<# components>:<# table bits>:<tag width>:<min history>:\n"
+           "      <max history>:<# base bits>:<use_alt_on_na bits>:<# loop bits>:\n"
+           "      <# corrector bits>",
+  .num_params = 9, .required_params = 0, .defaults = { 4, 10, 8, 4, 100, 11, 0, 0, 0 },
+  .min = { 2, 1, 2, 1, 1, 1, 0, 0, 0 },
+  .max = { TAGE_MAX_COMPONENTS, TAGE_MAX_TABLE_BITS, TAGE_MAX_TAG_WIDTH, TAGE_HIST_BUFFER - 1,
+           TAGE_HIST_BUFFER - 1, TAGE_MAX_TABLE_BITS, TAGE_MAX_USE_ALT_BITS, TAGE_MAX_LOOP_BITS,
+           TAGE_MAX_TABLE_BITS },
+  .init = tage_init, .predict = tage_predict, .train = tage_train,
+  .destroy = tage_destroy, .bits = tage_bits,
+  .host_bytes = tage_host_bytes,
+  .reset = tage_reset, .run = tage_run,
+  .checkpoint = tage_checkpoint, .components = tage_components,
+  .run_ahead = tage_run_ahead,
+};
+
+static const predictor_ops_t perceptron_ops = {
+  .name = "perceptron", .usage = "perceptron:<# history>:<# rows>",
+  .num_params = 2, .required_params = 0, .defaults = { 15, 128 },
+  .min = { 1, 1 }, .max = { PERCEPTRON_MAX_HIST, PERCEPTRON_MAX_ROWS },
+  .init = perceptron_init, .predict = perceptron_predict, .train = perceptron_train,
+  .destroy = perceptron_destroy, .bits = perceptron_bits,
+  .host_bytes = perceptron_host_bytes,
+  .reset = perceptron_reset, .run = perceptron_run,
+  .checkpoint = perceptron_checkpoint,
+};
+
+static const predictor_ops_t bimodal_ops = {
+  .name = "bimodal", .usage = "bimodal:<# index>",
+  .num_params = 1, .required_params = 1,
+  .min = { 0 }, .max = { INDEX_BITS_MAX },
+  .init = bimodal_init, .predict = bimodal_predict, .train = bimodal_train,
+  .destroy = bimodal_destroy, .bits = bimodal_bits,
+  .host_bytes = bimodal_host_bytes,
+  .reset = bimodal_reset, .run = bimodal_run,
+  .checkpoint = bimodal_checkpoint,
+  .run_ahead = bimodal_run_ahead,
+};
+
+// Indexed by bpType; new predictors are appended here
+const predictor_ops_t *predictor_registry[] = {
+  &static_ops, &gshare_ops, &tournament_ops, &custom_ops, &tage_ops,
+  &perceptron_ops, &bimodal_ops,
+};
+const int num_predictors = sizeof(predictor_registry) / sizeof(predictor_registry[0]);
+
+int
+predictor_lookup(const char *name, size_t len)
+{
+  for (int i = 0; i < num_predictors; i++) {
+    if (strlen(predictor_registry[i]->name) == len &&
+        !strncmp(predictor_registry[i]->name, name, len)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int
+predictor_parse(const char *spec, predictor_config_t *cfg)
+{
+  size_t n = strcspn(spec, ":");
+  int type = predictor_lookup(spec, n);
+  if (type < 0) {
+    return 0;
+  }
+  const predictor_ops_t *ops = predictor_registry[type];
+  cfg->bpType = type;
+  memcpy(cfg->params, ops->defaults, sizeof(cfg->params));
+
+  int given = 0;
+  for (spec += n; *spec == ':'; given++) {
+    char *end;
+    if (given == ops->num_params) {
+      return 0;
+    }
+    cfg->params[given] = strtol(spec + 1, &end, 10);
+    if (end == spec + 1) {
+      return 0;
+    }
+    spec = end;
+  }
+  return *spec == '\0' && given >= ops->required_params && predictor_valid(cfg);
+}
+
+int
+predictor_valid(const predictor_config_t *cfg)
+{
+  if (cfg->bpType < 0 || cfg->bpType >= num_predictors) {
+    return 0;
+  }
+  const predictor_ops_t *ops = predictor_registry[cfg->bpType];
+  for (int i = 0; i < ops->num_params; i++) {
+    if (cfg->params[i] < ops->min[i] || cfg->params[i] > ops->max[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+//------------------------------------//
+//     Per-Instance Predictor API     //
+//------------------------------------//
+
+predictor_t *
+predictor_create(const predictor_config_t *cfg)
+{
+  predictor_t *p = (predictor_t *)malloc(sizeof(predictor_t));
+  p->cfg = *cfg;
+  p->ops = predictor_registry[cfg->bpType];
+  p->state = p->ops->init(cfg->params);
+  if (p->state == NULL) {
+    free(p);
+    return NULL;
+  }
+  p->kernel = p->ops->select_kernel ? p->ops->select_kernel(cfg->params) : NULL;
+  p->lookahead = 0;
+  return p;
+}
+
+uint8_t
+predictor_predict(predictor_t *p, uint32_t pc)
+{
+  return p->ops->predict(p->state, pc);
+}
+
+void
+predictor_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  p->ops->train(p->state, pc, outcome);
+}
+
+uint32_t
+predictor_run(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+              uint64_t begin, uint64_t end)
+{
+  return predictor_run_block(p, pc, outcome, begin, end, NULL);
+}
+
+uint32_t
+predictor_run_block(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+                    uint64_t begin, uint64_t end, uint32_t *missed)
+{
+  if (p->lookahead > 0) {
+    return p->ops->run_ahead(p->state, pc, outcome, begin, end, missed, p->lookahead);
+  }
+  if (p->kernel != NULL) {
+    return p->kernel(p->state, pc, outcome, begin, end, missed);
+  }
+  return p->ops->run(p->state, pc, outcome, begin, end, missed);
+}
+
+int
+predictor_set_lookahead(predictor_t *p, int distance)
+{
+  if (p->ops->run_ahead == NULL) {
+    return 0;
+  }
+  p->lookahead = distance < 0 ? 0 :
+                 distance > PREDICTOR_MAX_LOOKAHEAD ? PREDICTOR_MAX_LOOKAHEAD : distance;
+  return 1;
+}
+
+void
+predictor_reset(predictor_t *p)
+{
+  p->ops->reset(p->state);
+}
+
+int
+predictor_components(const predictor_t *p, uint64_t *counts)
+{
+  if (p->ops->components == NULL) {
+    return 0;
+  }
+  return p->ops->components(p->state, counts);
+}
+
+uint64_t
+predictor_storage_bits(const predictor_t *p)
+{
+  return p->ops->bits(p->cfg.params);
+}
+
+uint64_t
+predictor_config_bits(const predictor_config_t *cfg)
+{
+  return predictor_registry[cfg->bpType]->bits(cfg->params);
+}
+
+size_t
+predictor_host_bytes(const predictor_t *p)
+{
+  return sizeof(predictor_t) + p->ops->host_bytes(p->state);
+}
+
+const predictor_config_t *
+predictor_config(const predictor_t *p)
+{
+  return &p->cfg;
+}
+
+// Checkpoint file header, followed by the predictor's own state
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  int32_t  bpType;
+  int32_t  params[PREDICTOR_MAX_PARAMS];
+  uint64_t position;       // Trace branches consumed when it was taken
+} checkpoint_header_t;
+
+#define CHECKPOINT_MAGIC    "BPCKPT"
+#define CHECKPOINT_VERSION  3
+
+int
+predictor_save(predictor_t *p, uint64_t position, FILE *f)
+{
+  checkpoint_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  hdr.version = CHECKPOINT_VERSION;
+  hdr.bpType = p->cfg.bpType;
+  memcpy(hdr.params, p->cfg.params, sizeof(hdr.params));
+  hdr.position = position;
+
+  return fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+         p->ops->checkpoint(p->state, f, 0);
+}
+
+predictor_t *
+predictor_restore(FILE *f, uint64_t *position)
+{
+  checkpoint_header_t hdr;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) ||
+      hdr.version != CHECKPOINT_VERSION) {
+    return NULL;
+  }
+
+  // The parameters size the tables, so they are checked before any
+  // are allocated
+  predictor_config_t cfg;
+  cfg.bpType = hdr.bpType;
+  memcpy(cfg.params, hdr.params, sizeof(cfg.params));
+  if (!predictor_valid(&cfg)) {
+    return NULL;
+  }
+  predictor_t *p = predictor_create(&cfg);
+  if (p == NULL) {
+    return NULL;
+  }
+  if (!p->ops->checkpoint(p->state, f, 1) || fgetc(f) != EOF) {
+    predictor_destroy(p);
+    return NULL;
+  }
+  *position = hdr.position;
+  return p;
+}
+
+void
+predictor_destroy(predictor_t *p)
+{
+  if (p == NULL) {
+    return;
+  }
+  p->ops->destroy(p->state);
+  free(p);
+}
+
+void
+predictor_describe(const predictor_config_t *cfg, char *buf, size_t len)
+{
+  const predictor_ops_t *ops = predictor_registry[cfg->bpType];
+  int n = snprintf(buf, len, "%s", ops->name);
+  for (int i = 0; i < ops->num_params && n > 0 && (size_t)n < len; i++) {
+    n += snprintf(buf + n, len - n, ":%d", cfg->params[i]);
+  }
+}
+
+//------------------------------------//
+//    Lockstep Predictor Families     //
+//------------------------------------//
+
+#define FAMILY_CHUNK 1024          // Branches whose indices are computed at once
+#define FAMILY_MAX_BITS 30
+
+// Members share the global history and the per-branch hash (pc ^ ghr
+// for gshare, pc for bimodal); a member's index is just the hash
+// masked to its width. Counters are held one per byte in a single
+// arena, member after member, each on its own cache line.
+//
+// The member loops are deliberately scalar. An index is one AND of the
+// shared hash, and consecutive branches can hit the same counter, so
+// the update loop carries a dependence through the table. A separate
+// vectorized index pass measured 1.1-1.2x slower. Packed ctr2_ tables
+// measured 1.5-2.2x slower, since each update becomes a read-modify-
+// write of a shared byte.
+struct predictor_family {
+  int bpType;
+  int n;
+  uint32_t ghr;
+  uint32_t *masks;
+  uint8_t **tables;
+  table_arena_t arena;
+};
+
+int
+predictor_family_member(const predictor_config_t *cfg)
+{
+  return (cfg->bpType == GSHARE || cfg->bpType == BIMODAL) &&
+         cfg->params[0] >= 0 && cfg->params[0] <= FAMILY_MAX_BITS;
+}
+
+predictor_family_t *
+predictor_family_create(const predictor_config_t *cfgs, int n)
+{
+  predictor_family_t *f = (predictor_family_t *)malloc(sizeof(predictor_family_t));
+  f->bpType = cfgs[0].bpType;
+  f->n = n;
+  f->ghr = 0;
+  f->masks = (uint32_t *)malloc(sizeof(uint32_t) * n);
+  f->tables = (uint8_t **)malloc(sizeof(uint8_t *) * n);
+
+  size_t size = 0;
+  for (int m = 0; m < n; m++) {
+    f->masks[m] = (1u << cfgs[m].params[0]) - 1;
+    size += table_bytes((size_t)f->masks[m] + 1);
+  }
+  if (!table_arena_init(&f->arena, size)) {
+    free(f->masks);
+    free(f->tables);
+    free(f);
+    return NULL;
+  }
+  for (int m = 0; m < n; m++) {
+    f->tables[m] = (uint8_t *)table_arena_take(&f->arena, (size_t)f->masks[m] + 1);
+    memset(f->tables[m], WN, (size_t)f->masks[m] + 1);
+  }
+  return f;
+}
+
+void
+predictor_family_run(predictor_family_t *f, const uint32_t *pc, const uint8_t *outcome,
+                     uint64_t begin, uint64_t end, uint64_t *mispredictions)
+{
+  uint32_t hash[FAMILY_CHUNK];
+  uint8_t taken[FAMILY_CHUNK];
+
+  for (uint64_t base = begin; base < end; base += FAMILY_CHUNK) {
+    int len = end - base < FAMILY_CHUNK ? (int)(end - base) : FAMILY_CHUNK;
+
+    // Hash and outcome of every branch in the chunk, computed once
+    // for all members
+    uint32_t ghr = f->ghr;
+    uint32_t use_ghr = f->bpType == GSHARE ? ~0u : 0;
+    for (int i = 0; i < len; i++) {
+      uint64_t b = base + i;
+      taken[i] = (outcome[b >> 3] >> (b & 7)) & 1;
+      hash[i] = pc[b] ^ (ghr & use_ghr);
+      ghr = (ghr << 1) | taken[i];
+    }
+    f->ghr = ghr;
+
+    // Each member then walks the chunk on its own table, which stays
+    // hot in cache for the whole chunk
+    for (int m = 0; m < f->n; m++) {
+      uint8_t *table = f->tables[m];
+      uint32_t mask = f->masks[m];
+      uint32_t incorrect = 0;
+      for (int i = 0; i < len; i++) {
+        uint8_t *ctr = &table[hash[i] & mask];
+        uint8_t c = *ctr;
+        incorrect += (c >> 1) != taken[i];
+        *ctr = ctr2_next(c, taken[i]);
+      }
+      mispredictions[m] += incorrect;
+    }
+  }
+}
+
+void
+predictor_family_destroy(predictor_family_t *f)
+{
+  if (f == NULL) {
+    return;
+  }
+  free(f->masks);
+  free(f->tables);
+  table_arena_release(&f->arena);
+  free(f);
+}
+
+//------------------------------------//
+//    Single-Instance Entry Points    //
+//------------------------------------//
+
+// Initialize the predictor from the global configuration variables;
+// predictors the globals do not describe take their registered
+// defaults
+//
+void
+init_predictor()
+{
+  predictor_config_t cfg;
+  cfg.bpType = bpType;
+  memcpy(cfg.params, predictor_registry[bpType]->defaults, sizeof(cfg.params));
+  if (bpType == GSHARE) {
+    cfg.params[0] = ghistoryBits;
+  } else if (bpType == TOURNAMENT) {
+    cfg.params[0] = ghistoryBits;
+    cfg.params[1] = lhistoryBits;
+    cfg.params[2] = pcIndexBits;
+  } else if (bpType == BIMODAL) {
+    cfg.params[0] = pcIndexBits;
+  }
+
+  predictor_destroy(default_predictor);
+  default_predictor = predictor_create(&cfg);
+}
+
+// Make a prediction for conditional branch instruction at PC 'pc'
+// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
+// indicates a prediction of not taken
+//
+uint8_t
+make_prediction(uint32_t pc)
+{
+  return predictor_predict(default_predictor, pc);
+}
+
+// Train the predictor the last executed branch at PC 'pc' and with
+// outcome 'outcome' (true indicates that the branch was taken, false
+// indicates that the branch was not taken)
+//
+void
+train_predictor(uint32_t pc, uint8_t outcome)
+{
+  predictor_train(default_predictor, pc, outcome);
+}
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 //
 // Student Information
@@ -31,6 +32,8 @@ extern const char *email;
 #define TOURNAMENT  2
 #define CUSTOM      3
 #define TAGE        4  // Add this line
+#define PERCEPTRON  5
+#define BIMODAL     6
 extern const char *bpName[];
 
 // Definitions for 2-bit counters
@@ -48,11 +51,81 @@ extern int pcIndexBits;  // Number of bits used for PC index
 extern int bpType;       // Branch Prediction Type
 extern int verbose;
 
+#define PREDICTOR_MAX_PARAMS 12
+#define PREDICTOR_MAX_COMPONENTS 16
+#define PREDICTOR_MAX_LOOKAHEAD 256
+
+// Configuration of a single predictor instance
+typedef struct {
+  int bpType;                          // Index into predictor_registry
+  int params[PREDICTOR_MAX_PARAMS];    // Numeric ':' separated parameters
+} predictor_config_t;
+
+// Opaque per-instance predictor state (see predictor.c)
+typedef struct predictor predictor_t;
+
+// Fused predict+train loop over branches [begin, end) of a PC array
+// and outcome bitmap, appending the PC of each mispredicted branch to
+// 'missed' when it is non-NULL; returns the number of mispredictions
+typedef uint32_t (*predictor_kernel_t)(void *state, const uint32_t *pc,
+                                       const uint8_t *outcome,
+                                       uint64_t begin, uint64_t end,
+                                       uint32_t *missed);
+
+// Interface every predictor implements. 'state' is whatever init()
+// returned; each instance owns its own.
+typedef struct {
+  const char *name;                      // Selected with --<name>[:<params>]
+  const char *usage;                     // Parameter synopsis for usage()
+  int num_params;                        // Numeric parameters accepted
+  int required_params;                   // Leading parameters with no default
+  int defaults[PREDICTOR_MAX_PARAMS];    // Values of omitted parameters
+  int min[PREDICTOR_MAX_PARAMS];         // Smallest accepted value of each
+  int max[PREDICTOR_MAX_PARAMS];         // Largest, which bounds the tables
+
+  void *(*init)(const int *params);            // NULL if the tables cannot be allocated
+  uint8_t (*predict)(void *state, uint32_t pc);
+  void (*train)(void *state, uint32_t pc, uint8_t outcome);
+  void (*destroy)(void *state);
+  uint64_t (*bits)(const int *params);          // Modeled hardware storage
+  size_t (*host_bytes)(const void *state);      // Memory the simulation uses
+  void (*reset)(void *state);                   // Back to the initial state
+
+  // Write the full state to 'f', or read it back over a freshly
+  // initialized instance of the same configuration when 'load' is set
+  int (*checkpoint)(void *state, FILE *f, int load);
+
+  // Fused predict+train over branches [begin, end) of a PC array and
+  // outcome bitmap, computing each index once per branch; appends the
+  // PC of each mispredicted branch to 'missed' when it is non-NULL
+  uint32_t (*run)(void *state, const uint32_t *pc, const uint8_t *outcome,
+                  uint64_t begin, uint64_t end, uint32_t *missed);
+
+  // Optional: a kernel specialized for these parameters, or NULL to
+  // fall back to run()
+  predictor_kernel_t (*select_kernel)(const int *params);
+
+  // Optional: run() that also computes the table indices of the branch
+  // 'distance' ahead of the one being predicted and prefetches them
+  uint32_t (*run_ahead)(void *state, const uint32_t *pc, const uint8_t *outcome,
+                        uint64_t begin, uint64_t end, uint32_t *missed,
+                        int distance);
+
+  // Optional: number of components that can provide a prediction, with
+  // how many predictions each has provided so far stored in 'counts'
+  int (*components)(const void *state, uint64_t *counts);
+} predictor_ops_t;
+
+// All known predictors, indexed by bpType
+extern const predictor_ops_t *predictor_registry[];
+extern const int num_predictors;
+
 //------------------------------------//
 //    Predictor Function Prototypes   //
 //------------------------------------//
 
-// Initialize the predictor
+// Initialize the predictor described by the global configuration
+// variables above; make_prediction() and train_predictor() act on it
 //
 void init_predictor();
 
@@ -68,4 +141,148 @@ uint8_t make_prediction(uint32_t pc);
 //
 void train_predictor(uint32_t pc, uint8_t outcome);
 
+//------------------------------------//
+//     Per-Instance Predictor API     //
+//------------------------------------//
+
+// Find the registry entry called 'name' (first 'len' characters)
+//
+// Returns its bpType, or -1 if there is none
+//
+int predictor_lookup(const char *name, size_t len);
+
+// Parse "<name>[:<params>]" (a --<type> option without the dashes,
+// single values only) into 'cfg'; omitted parameters take the
+// predictor's defaults
+//
+// Returns True if Successful
+//
+int predictor_parse(const char *spec, predictor_config_t *cfg);
+
+// Returns True if 'cfg' is a registered predictor with every
+// parameter within that predictor's limits
+//
+int predictor_valid(const predictor_config_t *cfg);
+
+// Allocate and initialize a predictor for configuration 'cfg', which
+// must be valid
+//
+// Returns NULL if its tables cannot be allocated
+//
+predictor_t *predictor_create(const predictor_config_t *cfg);
+
+// make_prediction()/train_predictor() for a specific instance
+//
+uint8_t predictor_predict(predictor_t *p, uint32_t pc);
+void predictor_train(predictor_t *p, uint32_t pc, uint8_t outcome);
+
+// Predict and train on branches [begin, end) of 'pc'/'outcome' (an
+// outcome bitmap), using a specialized kernel when one was selected
+//
+// Returns the number of mispredictions
+//
+uint32_t predictor_run(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+                       uint64_t begin, uint64_t end);
+
+// predictor_run() that also stores the PC of each mispredicted branch,
+// in order, in 'missed' (when non-NULL), which must have room for
+// 'end - begin' entries
+//
+// Returns the number of mispredictions, which is the number of PCs
+// stored
+//
+uint32_t predictor_run_block(predictor_t *p, const uint32_t *pc, const uint8_t *outcome,
+                             uint64_t begin, uint64_t end, uint32_t *missed);
+
+// Prefetch the table entries of the branch 'distance' ahead in
+// predictor_run() and predictor_run_block() (0 turns it off); results
+// are unchanged
+//
+// Returns True if the predictor supports lookahead
+//
+int predictor_set_lookahead(predictor_t *p, int distance);
+
+// Restore an instance to its freshly initialized state
+//
+void predictor_reset(predictor_t *p);
+
+// Cumulative number of predictions provided by each component of 'p'
+// (at most PREDICTOR_MAX_COMPONENTS) stored in 'counts'
+//
+// Returns the number of components, 0 if the predictor has none
+//
+int predictor_components(const predictor_t *p, uint64_t *counts);
+
+// Modeled hardware storage of an instance in bits
+//
+uint64_t predictor_storage_bits(const predictor_t *p);
+
+// Modeled hardware storage in bits of a predictor of configuration
+// 'cfg', which must be valid, without creating one
+//
+uint64_t predictor_config_bits(const predictor_config_t *cfg);
+
+// Host memory an instance occupies in bytes, which differs from its
+// modeled storage where fields are widened to whole bytes or padded
+//
+size_t predictor_host_bytes(const predictor_t *p);
+
+// Configuration 'p' was created with
+//
+const predictor_config_t *predictor_config(const predictor_t *p);
+
+// Write a checkpoint of 'p' (its configuration and full state) to 'f',
+// tagged with the number of trace branches it has consumed
+//
+// Returns True if Successful
+//
+int predictor_save(predictor_t *p, uint64_t position, FILE *f);
+
+// Recreate the predictor saved in checkpoint 'f', storing the trace
+// position it was taken at in 'position'
+//
+// Returns NULL if 'f' is not a valid checkpoint or the predictor
+// cannot be allocated
+//
+predictor_t *predictor_restore(FILE *f, uint64_t *position);
+
+// Free an instance and all of its tables
+//
+void predictor_destroy(predictor_t *p);
+
+// Write a printable name for 'cfg' (e.g. "gshare:13") into 'buf'
+//
+void predictor_describe(const predictor_config_t *cfg, char *buf, size_t len);
+
+//------------------------------------//
+//    Lockstep Predictor Families     //
+//------------------------------------//
+
+// Gshare or bimodal configurations that differ only in width,
+// simulated together: the history and per-branch hash are computed
+// once for all of them and only the table lookups are per member
+typedef struct predictor_family predictor_family_t;
+
+// Returns True if 'cfg' can be a member of a family
+//
+int predictor_family_member(const predictor_config_t *cfg);
+
+// A family of the 'n' configurations in 'cfgs', which must all be
+// members of the same bpType, each starting cold
+//
+// Returns NULL if the tables cannot be allocated
+//
+predictor_family_t *predictor_family_create(const predictor_config_t *cfgs, int n);
+
+// Predict and train every member on branches [begin, end) of a PC
+// array and outcome bitmap, adding member m's mispredictions to
+// 'mispredictions[m]'; identical to running the members one by one
+//
+void predictor_family_run(predictor_family_t *f, const uint32_t *pc, const uint8_t *outcome,
+                          uint64_t begin, uint64_t end, uint64_t *mispredictions);
+
+// Free a family and its tables
+//
+void predictor_family_destroy(predictor_family_t *f);
+
 #endif
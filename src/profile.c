@@ -0,0 +1,330 @@
+//========================================================//
+//  profile.c                                             //
+//  Source file for per-PC misprediction profiling        //
+//                                                        //
+//  The simulation hands over only the PCs it mispredicts //
+//  and both those and the executions are counted off the //
+//  simulation thread                                     //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+#define PROFILE_INITIAL_BITS 12
+#define PROFILE_BATCH 65536   // Mispredicted PCs handed to the hasher at once
+
+static void
+table_init(profile_table_t *t)
+{
+  t->capacity = 1 << PROFILE_INITIAL_BITS;
+  t->shift = 32 - PROFILE_INITIAL_BITS;
+  t->count = 0;
+  t->entries = (profile_entry_t *)calloc(t->capacity, sizeof(profile_entry_t));
+}
+
+// Double the table and rehash every entry
+//
+static void
+table_grow(profile_table_t *t)
+{
+  profile_entry_t *old = t->entries;
+  uint32_t old_capacity = t->capacity;
+
+  t->capacity *= 2;
+  t->shift--;
+  t->entries = (profile_entry_t *)calloc(t->capacity, sizeof(profile_entry_t));
+  for (uint32_t j = 0; j < old_capacity; j++) {
+    if (old[j].count == 0) {
+      continue;
+    }
+    uint32_t i = (old[j].pc * 0x9e3779b1u) >> t->shift;
+    while (t->entries[i].count != 0) {
+      i = (i + 1) & (t->capacity - 1);
+    }
+    t->entries[i] = old[j];
+  }
+  free(old);
+}
+
+// Find the entry for 'pc', or a free one claimed for it (the caller
+// counts into it right away), growing the table as needed
+//
+static profile_entry_t *
+table_insert(profile_table_t *t, uint32_t pc)
+{
+  uint32_t i = (pc * 0x9e3779b1u) >> t->shift;
+  profile_entry_t *e = &t->entries[i];
+  while (e->count != 0 && e->pc != pc) {
+    i = (i + 1) & (t->capacity - 1);
+    e = &t->entries[i];
+  }
+  if (e->count != 0) {
+    return e;
+  }
+  if (++t->count * 4 > t->capacity) {
+    t->count--;
+    table_grow(t);
+    return table_insert(t, pc);
+  }
+  e->pc = pc;
+  return e;
+}
+
+// table_insert() that checks the home slot of 'pc' inline first
+//
+static inline profile_entry_t *
+table_find(profile_table_t *t, uint32_t pc)
+{
+  profile_entry_t *e = &t->entries[(pc * 0x9e3779b1u) >> t->shift];
+  if (e->pc == pc && e->count != 0) {
+    return e;
+  }
+  return table_insert(t, pc);
+}
+
+// Count of 'pc' in 't', 0 if it is not there
+//
+static uint64_t
+table_lookup(const profile_table_t *t, uint32_t pc)
+{
+  uint32_t i = (pc * 0x9e3779b1u) >> t->shift;
+  while (t->entries[i].count != 0) {
+    if (t->entries[i].pc == pc) {
+      return t->entries[i].count;
+    }
+    i = (i + 1) & (t->capacity - 1);
+  }
+  return 0;
+}
+
+profile_t *
+profile_create()
+{
+  profile_t *prof = (profile_t *)calloc(1, sizeof(profile_t));
+  table_init(&prof->executed);
+  table_init(&prof->missed);
+  prof->batch = (uint32_t *)malloc(sizeof(uint32_t) * PROFILE_BATCH);
+  prof->pending = (uint32_t *)malloc(sizeof(uint32_t) * PROFILE_BATCH);
+  pthread_mutex_init(&prof->lock, NULL);
+  pthread_cond_init(&prof->wake, NULL);
+  return prof;
+}
+
+void
+profile_count(profile_t *prof, const uint32_t *pc, const uint8_t *outcome,
+              uint64_t begin, uint64_t end)
+{
+  for (uint64_t i = begin; i < end; i++) {
+    profile_entry_t *e = table_find(&prof->executed, pc[i]);
+    e->count++;
+    e->taken += (outcome[i >> 3] >> (i & 7)) & 1;
+  }
+}
+
+static void *
+profile_counter(void *arg)
+{
+  profile_t *prof = (profile_t *)arg;
+  profile_count(prof, prof->pc, prof->outcome, prof->begin, prof->end);
+  return NULL;
+}
+
+void
+profile_count_async(profile_t *prof, const uint32_t *pc, const uint8_t *outcome,
+                    uint64_t begin, uint64_t end)
+{
+  prof->pc = pc;
+  prof->outcome = outcome;
+  prof->begin = begin;
+  prof->end = end;
+  if (pthread_create(&prof->counter, NULL, profile_counter, prof) == 0) {
+    prof->counting = 1;
+  } else {
+    profile_count(prof, pc, outcome, begin, end);
+  }
+}
+
+// Count one misprediction of each of the 'n' PCs in 'missed'
+//
+static void
+count_missed(profile_t *prof, const uint32_t *missed, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++) {
+    table_find(&prof->missed, missed[i])->count++;
+  }
+}
+
+static void *
+profile_hasher(void *arg)
+{
+  profile_t *prof = (profile_t *)arg;
+  pthread_mutex_lock(&prof->lock);
+  for (;;) {
+    while (prof->pending_len == 0 && !prof->closing) {
+      pthread_cond_wait(&prof->wake, &prof->lock);
+    }
+    if (prof->pending_len == 0) {
+      break;
+    }
+    pthread_mutex_unlock(&prof->lock);
+    count_missed(prof, prof->pending, prof->pending_len);
+    pthread_mutex_lock(&prof->lock);
+    prof->pending_len = 0;
+    pthread_cond_broadcast(&prof->wake);
+  }
+  pthread_mutex_unlock(&prof->lock);
+  return NULL;
+}
+
+// Hand the full batch to the hasher, starting it the first time (or
+// count the batch right here if it cannot be started)
+//
+static void
+hand_batch(profile_t *prof)
+{
+  if (!prof->hashing) {
+    if (pthread_create(&prof->hasher, NULL, profile_hasher, prof) != 0) {
+      count_missed(prof, prof->batch, prof->batch_len);
+      prof->batch_len = 0;
+      return;
+    }
+    prof->hashing = 1;
+  }
+  pthread_mutex_lock(&prof->lock);
+  while (prof->pending_len != 0) {
+    pthread_cond_wait(&prof->wake, &prof->lock);
+  }
+  uint32_t *full = prof->batch;
+  prof->batch = prof->pending;
+  prof->pending = full;
+  prof->pending_len = prof->batch_len;
+  prof->batch_len = 0;
+  pthread_cond_broadcast(&prof->wake);
+  pthread_mutex_unlock(&prof->lock);
+}
+
+void
+profile_wait(profile_t *prof)
+{
+  if (prof->counting) {
+    pthread_join(prof->counter, NULL);
+    prof->counting = 0;
+  }
+  if (prof->hashing) {
+    pthread_mutex_lock(&prof->lock);
+    prof->closing = 1;
+    pthread_cond_broadcast(&prof->wake);
+    pthread_mutex_unlock(&prof->lock);
+    pthread_join(prof->hasher, NULL);
+    prof->hashing = 0;
+    prof->closing = 0;
+  }
+  count_missed(prof, prof->batch, prof->batch_len);
+  prof->batch_len = 0;
+}
+
+void
+profile_missed(profile_t *prof, const uint32_t *missed, uint32_t n)
+{
+  while (n > 0) {
+    uint32_t take = PROFILE_BATCH - prof->batch_len;
+    if (take > n) {
+      take = n;
+    }
+    memcpy(prof->batch + prof->batch_len, missed, sizeof(uint32_t) * take);
+    prof->batch_len += take;
+    missed += take;
+    n -= take;
+    if (prof->batch_len == PROFILE_BATCH) {
+      hand_batch(prof);
+    }
+  }
+}
+
+void
+profile_record(profile_t *prof, uint32_t pc, uint8_t outcome, uint8_t prediction)
+{
+  profile_count(prof, &pc, &outcome, 0, 1);
+  if (prediction != outcome) {
+    count_missed(prof, &pc, 1);
+  }
+}
+
+// A row of the report
+typedef struct {
+  uint32_t pc;
+  uint64_t executions;
+  uint64_t mispredictions;
+  uint64_t taken;
+} profile_row_t;
+
+// Most mispredictions first, then most executions, then lowest PC
+static int
+compare_rows(const void *a, const void *b)
+{
+  const profile_row_t *x = (const profile_row_t *)a;
+  const profile_row_t *y = (const profile_row_t *)b;
+  if (x->mispredictions != y->mispredictions) {
+    return x->mispredictions < y->mispredictions ? 1 : -1;
+  }
+  if (x->executions != y->executions) {
+    return x->executions < y->executions ? 1 : -1;
+  }
+  return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+void
+profile_report(const profile_t *prof, int top, FILE *out)
+{
+  const profile_table_t *executed = &prof->executed;
+  profile_row_t *rows = (profile_row_t *)malloc(sizeof(profile_row_t) * (executed->count + 1));
+  uint32_t n = 0;
+  uint64_t mispredictions = 0;
+  for (uint32_t i = 0; i < executed->capacity; i++) {
+    const profile_entry_t *e = &executed->entries[i];
+    if (e->count != 0) {
+      rows[n].pc = e->pc;
+      rows[n].executions = e->count;
+      rows[n].taken = e->taken;
+      rows[n].mispredictions = table_lookup(&prof->missed, e->pc);
+      mispredictions += rows[n].mispredictions;
+      n++;
+    }
+  }
+  qsort(rows, n, sizeof(profile_row_t), compare_rows);
+  if (top > (int)n) {
+    top = n;
+  }
+
+  fprintf(out, "Static Branches: %10u\n", n);
+  fprintf(out, "%-12s %10s %10s %7s %7s %7s %7s\n",
+          "PC", "Executions", "Incorrect", "Rate", "Taken", "Share", "Cumul");
+  double cumulative = 0;
+  for (int i = 0; i < top; i++) {
+    const profile_row_t *r = &rows[i];
+    double share = mispredictions ? 100.0 * r->mispredictions / mispredictions : 0;
+    cumulative += share;
+    fprintf(out, "0x%08x   %10llu %10llu %7.3f %7.3f %7.3f %7.3f\n", r->pc,
+            (unsigned long long)r->executions, (unsigned long long)r->mispredictions,
+            100.0 * r->mispredictions / r->executions,
+            100.0 * r->taken / r->executions, share, cumulative);
+  }
+  free(rows);
+}
+
+void
+profile_destroy(profile_t *prof)
+{
+  if (prof == NULL) {
+    return;
+  }
+  profile_wait(prof);
+  pthread_cond_destroy(&prof->wake);
+  pthread_mutex_destroy(&prof->lock);
+  free(prof->executed.entries);
+  free(prof->missed.entries);
+  free(prof->batch);
+  free(prof->pending);
+  free(prof);
+}
@@ -0,0 +1,103 @@
+//========================================================//
+//  profile.h                                             //
+//  Header file for per-PC misprediction profiling        //
+//                                                        //
+//  Counts executions, taken outcomes and mispredictions  //
+//  of every static branch in open-addressing tables      //
+//  and reports the hardest to predict ones               //
+//========================================================//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Counts for one static branch; an entry with a zero count is free.
+// The counters are 64 bits wide so a hot branch of a long trace
+// cannot wrap back to a free entry.
+//
+typedef struct {
+  uint32_t pc;
+  uint64_t count;
+  uint64_t taken;
+} profile_entry_t;
+
+// Linear probing hash table keyed by PC, kept at most a quarter full
+// so most branches sit in their home slot
+//
+typedef struct {
+  profile_entry_t *entries;
+  uint32_t shift;          // 32 - log2(capacity)
+  uint32_t capacity;
+  uint32_t count;
+} profile_table_t;
+
+// How often each branch executes and is taken depends only on the
+// trace, so those are counted apart from the mispredictions, and may
+// be counted by another thread. The simulation only copies the PCs it
+// mispredicts into 'batch'; a full batch is swapped with 'pending' and
+// hashed into 'missed' by the 'hasher' thread.
+//
+typedef struct {
+  profile_table_t executed;   // Executions and taken outcomes
+  profile_table_t missed;     // Mispredictions
+  pthread_t counter;          // Running profile_count_async()
+  int counting;
+  const uint32_t *pc;         // Arguments of profile_count_async()
+  const uint8_t *outcome;
+  uint64_t begin, end;
+  uint32_t *batch;
+  uint32_t batch_len;
+  uint32_t *pending;          // Owned by 'hasher' while 'pending_len' > 0
+  uint32_t pending_len;
+  pthread_t hasher;
+  int hashing;                // 'hasher' is running
+  int closing;                // ... and exits once 'pending' is empty
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} profile_t;
+
+// Returns an empty profile
+//
+profile_t *profile_create();
+
+// Count the executions and taken outcomes of branches [begin, end)
+// of a PC array and outcome bitmap
+//
+void profile_count(profile_t *prof, const uint32_t *pc, const uint8_t *outcome,
+                   uint64_t begin, uint64_t end);
+
+// profile_count() on a thread of its own, which profile_wait() joins;
+// the arrays must stay valid until then. Falls back to counting right
+// away if no thread can be started.
+//
+void profile_count_async(profile_t *prof, const uint32_t *pc, const uint8_t *outcome,
+                         uint64_t begin, uint64_t end);
+
+// Wait for profile_count_async() to finish, if it is running, and for
+// every misprediction passed to profile_missed() to be counted
+//
+void profile_wait(profile_t *prof);
+
+// Count one misprediction of each of the 'n' PCs in 'missed' (as
+// stored by predictor_run_block()); they are copied, and counted by
+// the time profile_wait() returns
+//
+void profile_missed(profile_t *prof, const uint32_t *missed, uint32_t n);
+
+// Count one execution of the branch at 'pc', and its misprediction if
+// 'prediction' differs from 'outcome'
+//
+void profile_record(profile_t *prof, uint32_t pc, uint8_t outcome, uint8_t prediction);
+
+// Print the 'top' branches with the most mispredictions to 'out'
+//
+void profile_report(const profile_t *prof, int top, FILE *out);
+
+// Free the profile
+//
+void profile_destroy(profile_t *prof);
+
+#endif
@@ -0,0 +1,452 @@
+//========================================================//
+//  server.c                                              //
+//  Source file for the simulation daemon                 //
+//                                                        //
+//  A thread per connection reads and parses job lines;   //
+//  batches take turns on the work-stealing pool, over    //
+//  the traces loaded at startup                          //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "sim.h"
+
+#define SERVER_BACKLOG 64
+#define SERVER_ID_LEN 64
+
+// A trace kept in memory for the life of the server. The table is
+// filled before the first connection is accepted and only read after,
+// so it needs no lock.
+typedef struct {
+  char *path;
+  char *name;        // File name without directory or extension
+  trace_t trace;
+} resident_trace_t;
+
+static resident_trace_t **resident = NULL;
+static int num_resident = 0;
+
+// Batches run one at a time, each on all the workers
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pool_threads = 0;
+static int pool_lookahead = 0;
+
+static volatile sig_atomic_t stopping = 0;
+
+// One job line of a batch
+typedef struct {
+  char id[SERVER_ID_LEN];
+  const char *error;         // Why the job cannot run, NULL if it can
+  resident_trace_t *trace;
+  sim_job_t job;
+} request_t;
+
+//------------------------------------//
+//          Resident Traces           //
+//------------------------------------//
+
+// Load the trace at 'path' and keep it
+//
+// Returns the new entry, or NULL if the trace cannot be read
+//
+static resident_trace_t *
+resident_add(const char *path)
+{
+  resident_trace_t *r = (resident_trace_t *)calloc(1, sizeof(resident_trace_t));
+  if (!trace_load(&r->trace, path)) {
+    free(r);
+    return NULL;
+  }
+  r->path = strdup(path);
+  const char *base = strrchr(path, '/');
+  r->name = strdup(base ? base + 1 : path);
+  char *ext = strrchr(r->name, '.');
+  if (ext != NULL && ext != r->name) {
+    *ext = '\0';
+  }
+
+  resident = (resident_trace_t **)realloc(resident,
+                 sizeof(resident_trace_t *) * (num_resident + 1));
+  resident[num_resident++] = r;
+  return r;
+}
+
+// Find a resident trace by path or name
+//
+// Returns NULL if there is no such trace
+//
+static resident_trace_t *
+resident_find(const char *key)
+{
+  for (int i = 0; i < num_resident; i++) {
+    if (!strcmp(resident[i]->path, key) || !strcmp(resident[i]->name, key)) {
+      return resident[i];
+    }
+  }
+  return NULL;
+}
+
+//------------------------------------//
+//          Job Requests              //
+//------------------------------------//
+
+// Parse a decimal branch count
+//
+// Returns True if Successful
+//
+static int
+parse_count(const char *s, uint64_t *value)
+{
+  char *end;
+  if (*s < '0' || *s > '9') {
+    return 0;
+  }
+  *value = strtoull(s, &end, 10);
+  return *end == '\0';
+}
+
+// Fill in 'req' from the key=value fields of 'line'; a malformed line
+// leaves the reason in req->error
+//
+static void
+parse_request(char *line, request_t *req)
+{
+  const char *trace = NULL;
+  int have_predictor = 0;
+  uint64_t warmup = 0, begin = 0, end = 0;
+  int have_end = 0;
+  char *save;
+
+  memset(req, 0, sizeof(*req));
+  for (char *field = strtok_r(line, " \t\r\n", &save); field != NULL;
+       field = strtok_r(NULL, " \t\r\n", &save)) {
+    char *value = strchr(field, '=');
+    if (value == NULL) {
+      req->error = "expected key=value";
+      return;
+    }
+    *value++ = '\0';
+    if (!strcmp(field, "id")) {
+      snprintf(req->id, sizeof(req->id), "%s", value);
+    } else if (!strcmp(field, "trace")) {
+      trace = value;
+    } else if (!strcmp(field, "predictor")) {
+      if (!predictor_parse(value, &req->job.cfg)) {
+        req->error = "bad predictor";
+        return;
+      }
+      have_predictor = 1;
+    } else if (!strcmp(field, "warmup")) {
+      if (!parse_count(value, &warmup)) {
+        req->error = "bad warmup";
+        return;
+      }
+    } else if (!strcmp(field, "begin")) {
+      if (!parse_count(value, &begin)) {
+        req->error = "bad begin";
+        return;
+      }
+    } else if (!strcmp(field, "end")) {
+      if (!parse_count(value, &end)) {
+        req->error = "bad end";
+        return;
+      }
+      have_end = 1;
+    } else {
+      req->error = "unknown field";
+      return;
+    }
+  }
+
+  if (trace == NULL || !have_predictor) {
+    req->error = "trace and predictor are required";
+    return;
+  }
+  if ((req->trace = resident_find(trace)) == NULL) {
+    req->error = "unknown trace";
+    return;
+  }
+  uint64_t n = req->trace->trace.num_branches;
+  if (!have_end) {
+    end = n;
+  }
+  if (begin > end || end > n) {
+    req->error = "window outside the trace";
+    return;
+  }
+  req->job.trace = &req->trace->trace;
+  req->job.begin = begin;
+  req->job.end = end;
+  req->job.warmup = warmup < begin ? warmup : begin;
+  req->job.lookahead = pool_lookahead;
+}
+
+// Write 's' as a JSON string
+//
+static void
+write_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\') {
+      fprintf(out, "\\%c", *s);
+    } else if ((unsigned char)*s < 0x20) {
+      fprintf(out, "\\u%04x", *s);
+    } else {
+      fputc(*s, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void
+write_result(FILE *out, const request_t *req)
+{
+  fputs("{\"id\":", out);
+  write_string(out, req->id);
+  if (req->error != NULL) {
+    fputs(",\"error\":", out);
+    write_string(out, req->error);
+    fputs("}\n", out);
+    return;
+  }
+
+  const sim_job_t *job = &req->job;
+  char name[64];
+  predictor_describe(&job->cfg, name, sizeof(name));
+  fputs(",\"trace\":", out);
+  write_string(out, req->trace->name);
+  fputs(",\"predictor\":", out);
+  write_string(out, name);
+  float mispredict_rate = job->num_branches ?
+                          100*((float)job->mispredictions / (float)job->num_branches) : 0;
+  fprintf(out, ",\"warmup\":%llu,\"begin\":%llu,\"end\":%llu,"
+               "\"branches\":%llu,\"mispredictions\":%llu,\"rate\":%.3f}\n",
+          (unsigned long long)job->warmup, (unsigned long long)job->begin,
+          (unsigned long long)job->end, (unsigned long long)job->num_branches,
+          (unsigned long long)job->mispredictions, mispredict_rate);
+}
+
+// Run the jobs of a batch that parsed and write every result
+//
+static void
+run_batch(request_t *reqs, int n, FILE *out)
+{
+  sim_job_t *jobs = (sim_job_t *)malloc(sizeof(sim_job_t) * n);
+  int num_jobs = 0;
+  for (int r = 0; r < n; r++) {
+    if (reqs[r].error == NULL) {
+      jobs[num_jobs++] = reqs[r].job;
+    }
+  }
+
+  if (num_jobs > 0) {
+    pthread_mutex_lock(&pool_lock);
+    sim_run_jobs(jobs, num_jobs, pool_threads);
+    pthread_mutex_unlock(&pool_lock);
+  }
+
+  num_jobs = 0;
+  for (int r = 0; r < n; r++) {
+    if (reqs[r].error == NULL) {
+      reqs[r].job = jobs[num_jobs++];
+      if (!reqs[r].job.allocated) {
+        reqs[r].error = "cannot allocate the predictor tables";
+      }
+    }
+    write_result(out, &reqs[r]);
+  }
+  free(jobs);
+}
+
+//------------------------------------//
+//          Connections               //
+//------------------------------------//
+
+// Read batches from one client until it closes its side
+//
+static void *
+serve_client(void *arg)
+{
+  int fd = (int)(intptr_t)arg;
+  FILE *in = fdopen(fd, "r");
+  FILE *out = fdopen(dup(fd), "w");
+  if (in == NULL || out == NULL) {
+    if (in != NULL) {
+      fclose(in);
+    } else {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  request_t *reqs = NULL;
+  int n = 0;
+  char *line = NULL;
+  size_t len = 0;
+  int eof = 0;
+  int refusing = 0;          // The batch has passed SERVER_MAX_BATCH
+  while (!eof) {
+    eof = getline(&line, &len, in) == -1;
+    if (!eof && line[strspn(line, " \t\r\n")] != '\0') {
+      if (n == SERVER_MAX_BATCH) {
+        // Answer the jobs held so far first, so the replies stay in
+        // the order of the lines
+        run_batch(reqs, n, out);
+        n = 0;
+        refusing = 1;
+      }
+      if (refusing) {
+        request_t req;
+        parse_request(line, &req);
+        req.error = "too many jobs in the batch";
+        write_result(out, &req);
+        continue;
+      }
+      reqs = (request_t *)realloc(reqs, sizeof(request_t) * (n + 1));
+      parse_request(line, &reqs[n++]);
+      continue;
+    }
+    if (n > 0) {
+      run_batch(reqs, n, out);
+      n = 0;
+    } else if (!refusing) {
+      continue;
+    }
+    refusing = 0;
+    if (fflush(out) != 0) {
+      break;
+    }
+  }
+
+  free(line);
+  free(reqs);
+  fclose(out);
+  fclose(in);
+  return NULL;
+}
+
+static void
+stop_server(int sig)
+{
+  stopping = 1;
+}
+
+// Bind a listening socket at 'path', replacing a stale socket file
+// that no server answers on
+//
+// Returns the socket, or -1 on failure
+//
+static int
+listen_at(const char *path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: socket path too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    int in_use = errno == EADDRINUSE;
+    int live = 0;
+    if (in_use) {
+      int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+      live = connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+      close(probe);
+      if (!live) {
+        unlink(path);
+      }
+    }
+    if (live) {
+      fprintf(stderr, "%s: a server is already running\n", path);
+      close(fd);
+      return -1;
+    }
+    if (!in_use || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      perror(path);
+      close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, SERVER_BACKLOG) != 0) {
+    perror("listen");
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  return fd;
+}
+
+int
+server_run(const char *path, char **paths, int num_traces, int num_threads,
+           int lookahead)
+{
+  pool_threads = num_threads;
+  pool_lookahead = lookahead;
+  for (int t = 0; t < num_traces; t++) {
+    if (resident_find(paths[t]) == NULL && resident_add(paths[t]) == NULL) {
+      fprintf(stderr, "%s: cannot load trace\n", paths[t]);
+      return 0;
+    }
+  }
+  if (num_resident == 0) {
+    fprintf(stderr, "--serve needs at least one trace\n");
+    return 0;
+  }
+
+  int fd = listen_at(path);
+  if (fd < 0) {
+    return 0;
+  }
+
+  // Without SA_RESTART a signal interrupts accept() so the loop sees it
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_server;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  fprintf(stderr, "Serving %d traces on %s\n", num_resident, path);
+  int ok = 1;
+  while (!stopping) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("accept");
+      ok = 0;
+      break;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_client, (void *)(intptr_t)client) != 0) {
+      close(client);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  close(fd);
+  unlink(path);
+  return ok;
+}
@@ -0,0 +1,51 @@
+//========================================================//
+//  server.h                                              //
+//  Header file for the simulation daemon                 //
+//                                                        //
+//  Keeps decoded traces resident and runs simulation     //
+//  jobs submitted over a Unix domain socket on the       //
+//  worker pool                                           //
+//========================================================//
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVER_MAX_BATCH 1024   // Job lines run together, at most
+
+// Protocol. A client sends one job per line, as space separated
+// key=value fields:
+//
+//   trace=<name or path> predictor=<name>[:<params>]
+//   [warmup=<n>] [begin=<n>] [end=<n>] [id=<token>]
+//
+// The trace is one loaded when the server started, matched by path or
+// by file name without its extension (int_1). Clients cannot load
+// others, so the server's memory stays fixed. Branches [begin, end)
+// are measured (the whole trace by default) after training on the
+// 'warmup' branches before 'begin'.
+//
+// A blank line or the end of the client's input closes a batch. The
+// batch is run on the worker pool, then one JSON object per job line
+// is written back, in order:
+//
+//   {"id":"a","trace":"int_1","predictor":"gshare:13","begin":0,
+//    "end":3771697,"branches":3771697,"mispredictions":...,"rate":...}
+//
+// or {"id":"a","error":"<reason>"} for a job that could not be run.
+// A connection may send any number of batches, each of at most
+// SERVER_MAX_BATCH jobs. Past that the jobs already sent are run and
+// answered, and every further line of the batch is answered with an
+// error right away.
+
+// Serve jobs on the socket at 'path' until SIGINT or SIGTERM, running
+// each batch on 'num_threads' workers (0 = one per online CPU) with
+// lookahead distance 'lookahead'. The 'num_traces' traces at 'paths'
+// are loaded first. Batches from different connections take turns on
+// the pool.
+//
+// Returns True if the server shut down cleanly
+//
+int server_run(const char *path, char **paths, int num_traces, int num_threads,
+               int lookahead);
+
+#endif
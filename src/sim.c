@@ -0,0 +1,191 @@
+//========================================================//
+//  sim.c                                                 //
+//  Source file for the trace simulation drivers          //
+//                                                        //
+//  Includes a work-stealing thread pool that runs        //
+//  (trace, config) jobs, or shards of a single trace,    //
+//  across all cores                                      //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "sim.h"
+
+uint64_t
+sim_run(predictor_t *p, const trace_t *t, uint64_t begin, uint64_t end)
+{
+  uint64_t mispredictions = 0;
+  while (end - begin > SIM_RUN_CHUNK) {
+    mispredictions += predictor_run(p, t->pc, t->outcome, begin, begin + SIM_RUN_CHUNK);
+    begin += SIM_RUN_CHUNK;
+  }
+  return mispredictions + predictor_run(p, t->pc, t->outcome, begin, end);
+}
+
+//------------------------------------//
+//      Work-Stealing Job Pool        //
+//------------------------------------//
+
+// Per-worker deque of job indices. The owner pops from the tail,
+// thieves take from the head; jobs are coarse so a lock per deque
+// costs nothing measurable.
+typedef struct {
+  pthread_mutex_t lock;
+  int *slots;
+  int head;
+  int tail;
+} job_deque_t;
+
+typedef struct {
+  sim_job_t *jobs;
+  job_deque_t *deques;
+  int num_workers;
+} job_pool_t;
+
+typedef struct {
+  job_pool_t *pool;
+  int id;
+} worker_t;
+
+static int
+deque_pop(job_deque_t *d)
+{
+  int job = -1;
+  pthread_mutex_lock(&d->lock);
+  if (d->head < d->tail) {
+    job = d->slots[--d->tail];
+  }
+  pthread_mutex_unlock(&d->lock);
+  return job;
+}
+
+static int
+deque_steal(job_deque_t *d)
+{
+  int job = -1;
+  pthread_mutex_lock(&d->lock);
+  if (d->head < d->tail) {
+    job = d->slots[d->head++];
+  }
+  pthread_mutex_unlock(&d->lock);
+  return job;
+}
+
+// Mispredictions over [begin, end) of 't', with those of the two
+// 'probe' long windows before 'end' (clipped to 'begin') in 'windows'
+static uint64_t
+run_probed(predictor_t *p, const trace_t *t, uint64_t begin, uint64_t end,
+           uint64_t probe, uint64_t *windows)
+{
+  uint64_t second = end - begin < probe ? begin : end - probe;
+  uint64_t first = second - begin < probe ? begin : second - probe;
+  uint64_t mispredictions = sim_run(p, t, begin, first);
+  windows[0] = sim_run(p, t, first, second);
+  windows[1] = sim_run(p, t, second, end);
+  return mispredictions + windows[0] + windows[1];
+}
+
+static void
+run_job(sim_job_t *job)
+{
+  predictor_t *p = predictor_create(&job->cfg);
+  job->allocated = p != NULL;
+  if (p == NULL) {
+    return;
+  }
+  predictor_set_lookahead(p, job->lookahead);
+  run_probed(p, job->trace, job->begin - job->warmup, job->begin,
+             job->probe, job->warmup_probe);
+  job->num_branches = job->end - job->begin;
+  job->mispredictions = run_probed(p, job->trace, job->begin, job->end,
+                                   job->probe, job->tail_probe);
+  predictor_destroy(p);
+}
+
+static void *
+worker_main(void *arg)
+{
+  worker_t *w = (worker_t *)arg;
+  job_pool_t *pool = w->pool;
+
+  for (;;) {
+    int job = deque_pop(&pool->deques[w->id]);
+
+    // Jobs never spawn jobs, so once every deque is empty we are done
+    for (int v = 1; job < 0 && v < pool->num_workers; v++) {
+      job = deque_steal(&pool->deques[(w->id + v) % pool->num_workers]);
+    }
+    if (job < 0) {
+      break;
+    }
+    run_job(&pool->jobs[job]);
+  }
+  return NULL;
+}
+
+// Returns True if every one of the 'num_jobs' jobs had its predictor
+//
+static int
+jobs_allocated(const sim_job_t *jobs, int num_jobs)
+{
+  for (int j = 0; j < num_jobs; j++) {
+    if (!jobs[j].allocated) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int
+sim_run_jobs(sim_job_t *jobs, int num_jobs, int num_threads)
+{
+  if (num_threads <= 0) {
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (num_threads > num_jobs) {
+    num_threads = num_jobs;
+  }
+  if (num_threads <= 1) {
+    for (int j = 0; j < num_jobs; j++) {
+      run_job(&jobs[j]);
+    }
+    return jobs_allocated(jobs, num_jobs);
+  }
+
+  job_pool_t pool;
+  pool.jobs = jobs;
+  pool.num_workers = num_threads;
+  pool.deques = (job_deque_t *)calloc(num_threads, sizeof(job_deque_t));
+
+  // Deal the jobs out round-robin so every worker starts with a share
+  for (int w = 0; w < num_threads; w++) {
+    pthread_mutex_init(&pool.deques[w].lock, NULL);
+    pool.deques[w].slots = (int *)malloc(sizeof(int) * (num_jobs / num_threads + 1));
+  }
+  for (int j = 0; j < num_jobs; j++) {
+    job_deque_t *d = &pool.deques[j % num_threads];
+    d->slots[d->tail++] = j;
+  }
+
+  pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+  worker_t *workers = (worker_t *)malloc(sizeof(worker_t) * num_threads);
+  for (int w = 0; w < num_threads; w++) {
+    workers[w].pool = &pool;
+    workers[w].id = w;
+    pthread_create(&threads[w], NULL, worker_main, &workers[w]);
+  }
+  for (int w = 0; w < num_threads; w++) {
+    pthread_join(threads[w], NULL);
+  }
+
+  for (int w = 0; w < num_threads; w++) {
+    pthread_mutex_destroy(&pool.deques[w].lock);
+    free(pool.deques[w].slots);
+  }
+  free(pool.deques);
+  free(threads);
+  free(workers);
+  return jobs_allocated(jobs, num_jobs);
+}
@@ -0,0 +1,57 @@
+//========================================================//
+//  sim.h                                                 //
+//  Header file for the trace simulation drivers          //
+//                                                        //
+//  Runs predictor instances over in-memory traces,      //
+//  alone or as a pool of (trace, config) jobs            //
+//========================================================//
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+
+// One (trace, predictor configuration) simulation and its result.
+// Branches [begin, end) are measured after training on the 'warmup'
+// branches before 'begin'. With a non-zero 'probe', mispredictions
+// are also recorded over the last two 'probe' long windows of the
+// warmup and of the measured branches, to compare a cold and a warm
+// predictor over the same stretch of trace.
+//
+typedef struct {
+  const trace_t *trace;
+  predictor_config_t cfg;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t warmup;
+  uint64_t probe;
+  int lookahead;               // Prefetch distance (see predictor_set_lookahead)
+  int allocated;               // The predictor's tables could be allocated
+  uint64_t num_branches;
+  uint64_t mispredictions;
+  uint64_t warmup_probe[2];    // Mispredictions at the end of the warmup
+  uint64_t tail_probe[2];      // Mispredictions at the end of [begin, end)
+} sim_job_t;
+
+// Longest range handed to predictor_run() at once, so its 32-bit
+// count cannot wrap however long the trace
+#define SIM_RUN_CHUNK (1ULL << 30)
+
+// Predict and train 'p' on branches [begin, end) of 't'
+//
+// Returns the number of mispredictions
+//
+uint64_t sim_run(predictor_t *p, const trace_t *t, uint64_t begin, uint64_t end);
+
+// Run every job on a pool of 'num_threads' workers (0 = one per
+// online CPU). Idle workers steal jobs from busy ones; each job fills
+// in only its own result fields, so results do not depend on the
+// schedule.
+//
+// Returns True if every job's predictor could be allocated
+//
+int sim_run_jobs(sim_job_t *jobs, int num_jobs, int num_threads);
+
+#endif
@@ -0,0 +1,180 @@
+//========================================================//
+//  stream.c                                              //
+//  Source file for the streaming text trace reader       //
+//                                                        //
+//  Decompression and parsing run on their own thread so  //
+//  they overlap with the simulation instead of stalling  //
+//  it one line at a time                                 //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream.h"
+#include "trace.h"
+
+#define STREAM_SPINS 100    // Yields before a waiting side goes to sleep
+
+// The producer has a free slot, or the consumer is closing
+//
+static int
+stream_has_space(trace_stream_t *s)
+{
+  return s->tail - __atomic_load_n(&s->head, __ATOMIC_SEQ_CST) < STREAM_SLOTS ||
+         __atomic_load_n(&s->stop, __ATOMIC_SEQ_CST);
+}
+
+// The consumer has a block, or the producer has published its last
+//
+static int
+stream_has_block(trace_stream_t *s)
+{
+  return s->head != __atomic_load_n(&s->tail, __ATOMIC_SEQ_CST) ||
+         __atomic_load_n(&s->done, __ATOMIC_SEQ_CST);
+}
+
+// Wait until 'ready' holds. The other side usually publishes soon, so
+// it is first polled, yielding to keep a single core machine moving,
+// then the waiter sleeps until stream_wake()
+//
+static void
+stream_wait(trace_stream_t *s, int (*ready)(trace_stream_t *))
+{
+  for (int spin = 0; spin < STREAM_SPINS; spin++) {
+    if (ready(s)) {
+      return;
+    }
+    sched_yield();
+  }
+
+  // 'waiters' is raised before the last check and the indices are
+  // published before it is read, both sequentially consistent, so
+  // either the check sees the update or the publisher sees the waiter
+  pthread_mutex_lock(&s->lock);
+  __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+  while (!ready(s)) {
+    pthread_cond_wait(&s->wake, &s->lock);
+  }
+  __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&s->lock);
+}
+
+// Wake the other side if it is asleep, after publishing an update
+//
+static void
+stream_wake(trace_stream_t *s)
+{
+  if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+static void *
+stream_producer(void *arg)
+{
+  trace_stream_t *s = (trace_stream_t *)arg;
+  char *buf = NULL;
+  size_t len = 0;
+  int eof = 0;
+
+  while (!eof && !__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) {
+    uint64_t tail = s->tail;
+    stream_wait(s, stream_has_space);
+    if (__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) {
+      free(buf);
+      return NULL;
+    }
+
+    trace_block_t *b = &s->slots[tail & (STREAM_SLOTS - 1)];
+    uint32_t n = 0;
+    memset(b->outcome, 0, sizeof(b->outcome));
+    while (n < STREAM_BLOCK) {
+      if (getline(&buf, &len, s->file) == -1) {
+        eof = 1;
+        break;
+      }
+      uint8_t outcome;
+      if (trace_parse_line(buf, &b->pc[n], &outcome)) {
+        b->outcome[n >> 3] |= outcome << (n & 7);
+        n++;
+      }
+    }
+    b->num_branches = n;
+    if (s->profile != NULL) {
+      uint64_t begin = s->skip < n ? s->skip : n;
+      profile_count(s->profile, b->pc, b->outcome, begin, n);
+      s->skip -= begin;
+    }
+    if (n > 0) {
+      __atomic_store_n(&s->tail, tail + 1, __ATOMIC_SEQ_CST);
+      stream_wake(s);
+    }
+  }
+
+  s->error = ferror(s->file);
+  free(buf);
+  __atomic_store_n(&s->done, eof, __ATOMIC_SEQ_CST);
+  stream_wake(s);
+  return NULL;
+}
+
+trace_stream_t *
+trace_stream_open(FILE *file, profile_t *profile, uint64_t skip)
+{
+  trace_stream_t *s = (trace_stream_t *)calloc(1, sizeof(trace_stream_t));
+  if (s == NULL) {
+    return NULL;
+  }
+  s->file = file;
+  s->profile = profile;
+  s->skip = skip;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->wake, NULL);
+  if (pthread_create(&s->thread, NULL, stream_producer, s) != 0) {
+    pthread_cond_destroy(&s->wake);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+const trace_block_t *
+trace_stream_next(trace_stream_t *s)
+{
+  uint64_t head = s->head;
+  stream_wait(s, stream_has_block);
+
+  // 'done' is set after the last tail update, so once it is seen an
+  // empty ring stays empty
+  if (head == __atomic_load_n(&s->tail, __ATOMIC_SEQ_CST)) {
+    return NULL;
+  }
+  return &s->slots[head & (STREAM_SLOTS - 1)];
+}
+
+void
+trace_stream_release(trace_stream_t *s)
+{
+  __atomic_store_n(&s->head, s->head + 1, __ATOMIC_SEQ_CST);
+  stream_wake(s);
+}
+
+int
+trace_stream_close(trace_stream_t *s)
+{
+  __atomic_store_n(&s->stop, 1, __ATOMIC_SEQ_CST);
+  stream_wake(s);
+  pthread_join(s->thread, NULL);
+  pthread_cond_destroy(&s->wake);
+  pthread_mutex_destroy(&s->lock);
+  int ok = s->done && !s->error;
+  if (s->file != stdin) {
+    fclose(s->file);
+  }
+  free(s);
+  return ok;
+}
@@ -0,0 +1,74 @@
+//========================================================//
+//  stream.h                                              //
+//  Header file for the streaming text trace reader       //
+//                                                        //
+//  A producer thread decompresses and parses a text      //
+//  trace into fixed size blocks of branches, handed to   //
+//  the simulation loop through a lock-free ring buffer   //
+//========================================================//
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "profile.h"
+
+#define STREAM_BLOCK 4096   // Branches per block
+#define STREAM_SLOTS 16     // Blocks in the ring (power of two)
+
+// A block of parsed branches, laid out like a binary trace payload
+//
+typedef struct {
+  uint32_t num_branches;
+  uint32_t pc[STREAM_BLOCK];
+  uint8_t outcome[STREAM_BLOCK / 8];  // bitmap, LSB first
+} trace_block_t;
+
+// Single producer, single consumer ring of blocks. 'head' is only
+// written by the consumer and 'tail' only by the producer, so the
+// indices need no lock. A side that finds the ring full (or empty)
+// polls briefly, then sleeps on 'wake' until the other side publishes.
+//
+typedef struct {
+  FILE *file;
+  pthread_t thread;
+  trace_block_t slots[STREAM_SLOTS];
+  uint64_t head;     // Next block to consume
+  uint64_t tail;     // Next block to fill
+  int done;          // Producer has published its last block
+  int stop;          // Consumer is closing early
+  int error;         // Producer hit a read error
+  profile_t *profile; // Counts executions after the first 'skip'
+  uint64_t skip;      // branches read, when non-NULL
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int waiters;       // Sides asleep on 'wake'
+} trace_stream_t;
+
+// Start a producer thread reading 'file' (plain or from trace_fopen).
+// If 'profile' is non-NULL the producer also counts the executions of
+// every branch after the first 'skip' in it, with profile_count().
+//
+// Returns NULL on failure
+//
+trace_stream_t *trace_stream_open(FILE *file, profile_t *profile, uint64_t skip);
+
+// Wait for the next block of branches
+//
+// Returns NULL once the trace is exhausted
+//
+const trace_block_t *trace_stream_next(trace_stream_t *s);
+
+// Hand the block returned by trace_stream_next() back to the producer
+//
+void trace_stream_release(trace_stream_t *s);
+
+// Stop the producer, close the file and free the stream
+//
+// Returns True if the whole trace was read without error
+//
+int trace_stream_close(trace_stream_t *s);
+
+#endif
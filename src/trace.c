@@ -0,0 +1,463 @@
+//========================================================//
+//  trace.c                                               //
+//  Source file for the binary branch trace format        //
+//                                                        //
+//  Converts text traces to the packed binary layout and  //
+//  maps binary traces back into memory for replay        //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bzlib.h>
+#include "trace.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static uint64_t
+fnv1a(uint64_t hash, const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t
+trace_checksum(const trace_t *t)
+{
+  uint64_t hash = FNV_OFFSET;
+  hash = fnv1a(hash, (const uint8_t *)t->pc, sizeof(uint32_t) * t->num_branches);
+  hash = fnv1a(hash, t->outcome, trace_bitmap_bytes(t->num_branches));
+  return hash;
+}
+
+int
+trace_is_binary(const char *path)
+{
+  char magic[8];
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  int ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+           !memcmp(magic, TRACE_MAGIC, sizeof(magic));
+  fclose(f);
+  return ok;
+}
+
+int
+trace_open(trace_t *t, const char *path)
+{
+  memset(t, 0, sizeof(*t));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(trace_header_t)) {
+    fprintf(stderr, "%s: not a binary trace\n", path);
+    close(fd);
+    return 0;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror(path);
+    return 0;
+  }
+  madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+  t->base = base;
+  t->size = st.st_size;
+  t->mapped = 1;
+
+  const trace_header_t *hdr = (const trace_header_t *)base;
+  if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) ||
+      hdr->version != TRACE_VERSION ||
+      hdr->header_size != sizeof(trace_header_t)) {
+    fprintf(stderr, "%s: bad binary trace header\n", path);
+    trace_close(t);
+    return 0;
+  }
+  // Four bytes of PC and at most one of bitmap per branch, so a count
+  // below this bound cannot overflow the size computed from it
+  uint64_t n = hdr->num_branches;
+  if (n > (SIZE_MAX - sizeof(trace_header_t)) / 5) {
+    fprintf(stderr, "%s: bad binary trace branch count\n", path);
+    trace_close(t);
+    return 0;
+  }
+  if (t->size != sizeof(trace_header_t) + sizeof(uint32_t) * n + trace_bitmap_bytes(n)) {
+    fprintf(stderr, "%s: truncated binary trace\n", path);
+    trace_close(t);
+    return 0;
+  }
+
+  t->num_branches = n;
+  t->pc = (const uint32_t *)((const char *)base + sizeof(trace_header_t));
+  t->outcome = (const uint8_t *)(t->pc + n);
+
+  if (trace_checksum(t) != hdr->checksum) {
+    fprintf(stderr, "%s: binary trace checksum mismatch\n", path);
+    trace_close(t);
+    return 0;
+  }
+  return 1;
+}
+
+//------------------------------------//
+//      In-process bzip2 Reading      //
+//------------------------------------//
+
+// State behind a FILE opened by trace_fopen() on a bzip2 file
+typedef struct {
+  FILE *file;
+  BZFILE *bz;
+  int eof;
+} bz_cookie_t;
+
+static ssize_t
+bz_cookie_read(void *cookie, char *out, size_t size)
+{
+  bz_cookie_t *c = (bz_cookie_t *)cookie;
+  int n = 0;
+  int err;
+
+  while (n == 0 && !c->eof) {
+    n = BZ2_bzRead(&err, c->bz, out, size > INT_MAX ? INT_MAX : (int)size);
+    if (err == BZ_STREAM_END) {
+      // Files written by parallel compressors hold several streams
+      // back to back; carry on into the next one if there is one
+      char unused[BZ_MAX_UNUSED];
+      void *tail;
+      int num_unused;
+      BZ2_bzReadGetUnused(&err, c->bz, &tail, &num_unused);
+      memcpy(unused, tail, num_unused);
+      BZ2_bzReadClose(&err, c->bz);
+      c->bz = NULL;
+      int next = num_unused == 0 ? fgetc(c->file) : 0;
+      if (next == EOF) {
+        c->eof = 1;
+      } else {
+        if (num_unused == 0) {
+          unused[num_unused++] = next;
+        }
+        c->bz = BZ2_bzReadOpen(&err, c->file, 0, 0, unused, num_unused);
+        if (err != BZ_OK) {
+          return -1;
+        }
+      }
+    } else if (err != BZ_OK) {
+      return -1;
+    }
+  }
+  return n;
+}
+
+static int
+bz_cookie_close(void *cookie)
+{
+  bz_cookie_t *c = (bz_cookie_t *)cookie;
+  int err;
+  if (c->bz != NULL) {
+    BZ2_bzReadClose(&err, c->bz);
+  }
+  int ret = fclose(c->file);
+  free(c);
+  return ret;
+}
+
+FILE *
+trace_fopen(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  char magic[3];
+  int is_bzip2 = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                 !memcmp(magic, "BZh", sizeof(magic));
+  rewind(f);
+  if (!is_bzip2) {
+    return f;
+  }
+
+  int err;
+  bz_cookie_t *c = (bz_cookie_t *)calloc(1, sizeof(bz_cookie_t));
+  c->file = f;
+  c->bz = BZ2_bzReadOpen(&err, f, 0, 0, NULL, 0);
+  if (err != BZ_OK) {
+    fprintf(stderr, "%s: cannot open bzip2 stream\n", path);
+    BZ2_bzReadClose(&err, c->bz);
+    fclose(f);
+    free(c);
+    return NULL;
+  }
+
+  cookie_io_functions_t io = { .read = bz_cookie_read, .close = bz_cookie_close };
+  return fopencookie(c, "r", io);
+}
+
+int
+trace_load_text(trace_t *t, FILE *stream)
+{
+  memset(t, 0, sizeof(*t));
+
+  size_t cap = 1 << 20;
+  uint64_t n = 0;
+  uint32_t *pcs = (uint32_t *)malloc(sizeof(uint32_t) * cap);
+  uint8_t *bits = (uint8_t *)calloc(cap >> 3, 1);
+  char *buf = NULL;
+  size_t len = 0;
+
+  while (getline(&buf, &len, stream) != -1) {
+    uint32_t pc;
+    uint8_t outcome;
+    if (!trace_parse_line(buf, &pc, &outcome)) {
+      continue;
+    }
+    if (n == cap) {
+      pcs = (uint32_t *)realloc(pcs, sizeof(uint32_t) * cap * 2);
+      bits = (uint8_t *)realloc(bits, cap >> 2);
+      memset(bits + (cap >> 3), 0, cap >> 3);
+      cap *= 2;
+    }
+    pcs[n] = pc;
+    bits[n >> 3] |= outcome << (n & 7);
+    n++;
+  }
+  free(buf);
+
+  // Repack into a single block laid out like the binary payload
+  size_t size = sizeof(uint32_t) * n + trace_bitmap_bytes(n);
+  char *base = (char *)malloc(size ? size : 1);
+  memcpy(base, pcs, sizeof(uint32_t) * n);
+  memcpy(base + sizeof(uint32_t) * n, bits, trace_bitmap_bytes(n));
+  free(pcs);
+  free(bits);
+
+  t->num_branches = n;
+  t->pc = (const uint32_t *)base;
+  t->outcome = (const uint8_t *)(base + sizeof(uint32_t) * n);
+  t->base = base;
+  t->size = size;
+  t->mapped = 0;
+  return 1;
+}
+
+//------------------------------------//
+//       Decoded Trace Cache          //
+//------------------------------------//
+
+// Directory holding decoded copies of text traces, "" when disabled
+static char cache_dir[PATH_MAX];
+
+// Create 'dir' and any missing parents
+//
+// Returns True if the directory exists afterwards
+//
+static int
+make_dirs(const char *dir)
+{
+  char buf[PATH_MAX];
+  if (snprintf(buf, sizeof(buf), "%s", dir) >= (int)sizeof(buf)) {
+    return 0;
+  }
+  for (char *p = buf + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      if (mkdir(buf, 0755) < 0 && errno != EEXIST) {
+        return 0;
+      }
+      *p = '/';
+    }
+  }
+  return mkdir(buf, 0755) == 0 || errno == EEXIST;
+}
+
+int
+trace_cache_enable(const char *dir)
+{
+  char buf[PATH_MAX];
+  const char *env;
+  if (dir == NULL) {
+    if ((env = getenv("BPTRACE_CACHE")) != NULL && *env) {
+      dir = env;
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env) {
+      snprintf(buf, sizeof(buf), "%s/bptrace", env);
+      dir = buf;
+    } else if ((env = getenv("HOME")) != NULL && *env) {
+      snprintf(buf, sizeof(buf), "%s/.cache/bptrace", env);
+      dir = buf;
+    } else {
+      return 0;
+    }
+  }
+  if (!make_dirs(dir) || snprintf(cache_dir, sizeof(cache_dir), "%s", dir) >= (int)sizeof(cache_dir)) {
+    cache_dir[0] = '\0';
+    return 0;
+  }
+  return 1;
+}
+
+void
+trace_cache_disable()
+{
+  cache_dir[0] = '\0';
+}
+
+// Name the cache entry of the file at 'path' after the FNV-1a hash
+// and size of its contents, so a renamed copy still hits and an
+// edited file misses
+//
+// Returns True if Successful
+//
+static int
+cache_entry_path(const char *path, char *entry, size_t len)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return 0;
+  }
+  uint64_t hash = FNV_OFFSET;
+  if (st.st_size > 0) {
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return 0;
+    }
+    hash = fnv1a(hash, (const uint8_t *)data, st.st_size);
+    munmap(data, st.st_size);
+  }
+  close(fd);
+  return snprintf(entry, len, "%s/%016llx-%llu.bpt", cache_dir,
+                  (unsigned long long)hash, (unsigned long long)st.st_size) < (int)len;
+}
+
+// Write 't' as cache entry 'entry'. The trace goes to a private
+// temporary file that is renamed into place once complete, so
+// concurrent processes never see a partial entry; if several populate
+// the same entry at once, the last rename wins with identical contents.
+//
+// Returns True if Successful
+//
+static int
+cache_store(const trace_t *t, const char *entry)
+{
+  char tmp[PATH_MAX];
+  if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", entry) >= (int)sizeof(tmp)) {
+    return 0;
+  }
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    return 0;
+  }
+  FILE *f = fdopen(fd, "wb");
+  if (f == NULL) {
+    close(fd);
+    unlink(tmp);
+    return 0;
+  }
+  int ok = trace_write(t, f);
+  ok = fclose(f) == 0 && ok;
+  if (!ok || chmod(tmp, 0644) < 0 || rename(tmp, entry) < 0) {
+    unlink(tmp);
+    return 0;
+  }
+  return 1;
+}
+
+// Parse a text trace into 't'
+//
+// Returns True if Successful
+//
+static int
+load_text_file(trace_t *t, const char *path)
+{
+  FILE *f = trace_fopen(path);
+  if (f == NULL) {
+    return 0;
+  }
+  trace_load_text(t, f);
+  if (ferror(f)) {
+    fprintf(stderr, "%s: read error\n", path);
+    fclose(f);
+    trace_close(t);
+    return 0;
+  }
+  fclose(f);
+  return 1;
+}
+
+int
+trace_load(trace_t *t, const char *path)
+{
+  if (trace_is_binary(path)) {
+    return trace_open(t, path);
+  }
+
+  char entry[PATH_MAX];
+  if (!cache_dir[0] || !cache_entry_path(path, entry, sizeof(entry))) {
+    return load_text_file(t, path);
+  }
+  if (access(entry, R_OK) == 0 && trace_open(t, entry)) {
+    return 1;
+  }
+
+  // Miss (or an unreadable entry, which is replaced): decode once and
+  // keep the parsed copy; failing to store it only costs the next run
+  if (!load_text_file(t, path)) {
+    return 0;
+  }
+  cache_store(t, entry);
+  return 1;
+}
+
+int
+trace_write(const trace_t *t, FILE *stream)
+{
+  trace_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.version = TRACE_VERSION;
+  hdr.header_size = sizeof(trace_header_t);
+  hdr.num_branches = t->num_branches;
+  hdr.checksum = trace_checksum(t);
+
+  size_t nbits = trace_bitmap_bytes(t->num_branches);
+  return fwrite(&hdr, sizeof(hdr), 1, stream) == 1 &&
+         fwrite(t->pc, sizeof(uint32_t), t->num_branches, stream) == t->num_branches &&
+         fwrite(t->outcome, 1, nbits, stream) == nbits;
+}
+
+void
+trace_close(trace_t *t)
+{
+  if (t->base != NULL) {
+    if (t->mapped) {
+      munmap(t->base, t->size);
+    } else {
+      free(t->base);
+    }
+  }
+  memset(t, 0, sizeof(*t));
+}
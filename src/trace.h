@@ -0,0 +1,133 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for the binary branch trace format        //
+//                                                        //
+//  A binary trace is a fixed header followed by the PCs  //
+//  of every branch as packed uint32_t words and then the //
+//  outcomes as a bitmap (bit i = outcome of branch i).   //
+//  Traces are mmapped and replayed with zero parsing.    //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TRACE_MAGIC    "BPTRACE"   // 7 chars + NUL fill the 8 byte magic
+#define TRACE_VERSION  1
+
+// On-disk header; 32 bytes so the PC array stays 8 byte aligned
+//
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t header_size;    // sizeof(trace_header_t), payload starts here
+  uint64_t num_branches;
+  uint64_t checksum;       // FNV-1a over the PC array and outcome bitmap
+} trace_header_t;
+
+// A decoded trace held in memory, either mmapped from a binary
+// trace file or parsed from a text trace into heap buffers
+//
+typedef struct {
+  uint64_t num_branches;
+  const uint32_t *pc;
+  const uint8_t *outcome;  // bitmap, LSB first within each byte
+  void *base;              // mapping or heap block backing pc/outcome
+  size_t size;
+  int mapped;
+} trace_t;
+
+// Outcome (TAKEN/NOTTAKEN) of branch 'i'
+//
+static inline uint8_t
+trace_outcome(const trace_t *t, uint64_t i)
+{
+  return (t->outcome[i >> 3] >> (i & 7)) & 1;
+}
+
+// Size in bytes of the outcome bitmap for 'n' branches
+//
+static inline size_t
+trace_bitmap_bytes(uint64_t n)
+{
+  return (size_t)((n + 7) >> 3);
+}
+
+// Parse one text trace line ("0x<pc> <outcome>")
+//
+// Returns True if the line holds a branch
+//
+static inline int
+trace_parse_line(const char *line, uint32_t *pc, uint8_t *outcome)
+{
+  char *end;
+  *pc = strtoul(line, &end, 16);
+  if (end == line) {
+    return 0;
+  }
+  *outcome = strtol(end, NULL, 10) != 0;
+  return 1;
+}
+
+// Returns True if the file at 'path' starts with the binary trace magic
+//
+int trace_is_binary(const char *path);
+
+// Map a binary trace file and verify its header and checksum
+//
+// Returns True if Successful
+//
+int trace_open(trace_t *t, const char *path);
+
+// Open a text trace for reading; bzip2 compressed files (recognised
+// by their magic) are decompressed in-process as they are read
+//
+// Returns NULL on failure
+//
+FILE *trace_fopen(const char *path);
+
+// Parse a text trace ("0x<pc> <outcome>" per line) into memory
+//
+// Returns True if Successful
+//
+int trace_load_text(trace_t *t, FILE *stream);
+
+// Load any trace file into memory: binary traces are mapped, text
+// traces (plain or bzip2 compressed) are parsed, or mapped from the
+// decoded trace cache when it is enabled and holds them
+//
+// Returns True if Successful
+//
+int trace_load(trace_t *t, const char *path);
+
+// Keep decoded copies of text traces in 'dir', or when NULL in
+// $BPTRACE_CACHE, $XDG_CACHE_HOME/bptrace or ~/.cache/bptrace. Entries
+// are binary traces named after the hash and size of the source file,
+// written on first use and mapped by trace_load() thereafter.
+//
+// Returns True if the directory is usable
+//
+int trace_cache_enable(const char *dir);
+
+// Stop consulting and populating the cache
+//
+void trace_cache_disable();
+
+// Write 't' to 'stream' in the binary trace format
+//
+// Returns True if Successful
+//
+int trace_write(const trace_t *t, FILE *stream);
+
+// Release the memory or mapping held by 't'
+//
+void trace_close(trace_t *t);
+
+// FNV-1a checksum of a trace payload
+//
+uint64_t trace_checksum(const trace_t *t);
+
+#endif